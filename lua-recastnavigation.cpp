@@ -14,6 +14,7 @@ extern "C"
 #endif
 
 #include "recastnavigation.h"
+#include "recastnavigation_trace.h"
 
 static void *
 check_userdata(lua_State *L, int idx)
@@ -59,6 +60,50 @@ struct s_navigation
     RecastNavigationHandle *handle;
 };
 
+static void
+read_create_options(lua_State *L, int idx, RecastNavigationHandle::CreateOptions &options)
+{
+    if (lua_isnoneornil(L, idx))
+        return;
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    lua_getfield(L, idx, "height_cell");
+    options.heightCellSize = luaL_optnumber(L, -1, options.heightCellSize);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "landmarks");
+    options.landmarkCount = luaL_optinteger(L, -1, options.landmarkCount);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "landmark_file");
+    options.landmarkPath = luaL_optstring(L, -1, "");
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "reorder");
+    options.reorderTiles = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "pvs_cell");
+    options.visibilityCellSize = luaL_optnumber(L, -1, options.visibilityCellSize);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "pvs_range");
+    options.visibilityRange = luaL_optnumber(L, -1, options.visibilityRange);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "pvs_file");
+    options.visibilityPath = luaL_optstring(L, -1, "");
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "lean_height_error");
+    options.leanHeightError = luaL_optnumber(L, -1, options.leanHeightError);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "lean_bv_polys");
+    options.leanBvPolys = luaL_optinteger(L, -1, options.leanBvPolys);
+    lua_pop(L, 1);
+}
+
 static int
 lnew(lua_State *L)
 {
@@ -67,11 +112,18 @@ lnew(lua_State *L)
     size_t l;
     const char *respath = luaL_checklstring(L, 2, &l);
 
+    RecastNavigationHandle::CreateOptions options;
+    read_create_options(L, 3, options);
+
     struct s_navigation *nav = (struct s_navigation *)lua_newuserdata(L, sizeof(struct s_navigation));
     nav->scene = scene;
     nav->handle = NULL;
 
-    nav->handle = RecastNavigationHandle::Create(respath);
+    // upvalue 2 is set on recastnavigation.instance
+    if (lua_toboolean(L, lua_upvalueindex(2)))
+        nav->handle = RecastNavigationHandle::CreateInstance(respath, options);
+    else
+        nav->handle = RecastNavigationHandle::Create(respath, options);
     if (!nav->handle)
     {
         lua_pushnil(L);
@@ -83,6 +135,15 @@ lnew(lua_State *L)
     return 1;
 }
 
+static int
+push_vector3(lua_State *L, const NFVector3 &v)
+{
+    lua_pushnumber(L, v.X());
+    lua_pushnumber(L, v.Y());
+    lua_pushnumber(L, v.Z());
+    return 3;
+}
+
 static int
 lrelease(lua_State *L)
 {
@@ -101,6 +162,39 @@ lrelease(lua_State *L)
     return 0;
 }
 
+static void
+read_path_quality(lua_State *L, int idx, RecastNavigationHandle::PathQuality &quality)
+{
+    quality.epsilon = luaL_optnumber(L, idx, quality.epsilon);
+    quality.maxNodes = luaL_optinteger(L, idx + 1, quality.maxNodes);
+    luaL_argcheck(L, quality.maxNodes > 0, idx + 1, "max_nodes should be positive");
+}
+
+static int
+check_filter(lua_State *L, int idx, struct s_navigation *nav)
+{
+    int filter = luaL_optinteger(L, idx, 0);
+    luaL_argcheck(L, filter >= 0 && filter < (int)nav->handle->filters.size(), idx, "unknown filter");
+    return filter;
+}
+
+// Definition of profile 'filter' for the trace, NULL for the default one.
+static const NavTraceFilter *
+trace_filter(struct s_navigation *nav, int filter, NavTraceFilter &def)
+{
+    if (filter == 0)
+        return NULL;
+
+    const NavFilterProfile &profile = nav->handle->GetFilter(filter);
+    memset(&def, 0, sizeof(def));
+    def.id = filter;
+    def.includeFlags = profile.getIncludeFlags();
+    def.excludeFlags = profile.getExcludeFlags();
+    for (int i = 0; i < NAV_TRACE_AREAS && i < DT_MAX_AREAS; i++)
+        def.areaCosts[i] = profile.getAreaCost(i);
+    return &def;
+}
+
 static int
 lFindStraightPath(lua_State *L)
 {
@@ -113,11 +207,25 @@ lFindStraightPath(lua_State *L)
     float end_y = luaL_checknumber(L, 6);
     float end_z = luaL_checknumber(L, 7);
 
+    RecastNavigationHandle::PathQuality quality;
+    read_path_quality(L, 8, quality);
+    int filter = check_filter(L, 10, nav);
+
     NFVector3 start(start_x, start_y, start_z);
     NFVector3 end(end_x, end_y, end_z);
 
     std::vector<NFVector3> paths;
-    int pos = nav->handle->FindStraightPath(start, end, paths);
+    int flags = 0;
+    NavTraceWriter &trace = NavTraceWriter::Instance();
+    uint64_t beginNs = trace.IsOpen() ? NavTraceWriter::Now() : 0;
+    int pos = nav->handle->FindStraightPath(start, end, paths, quality, &flags, filter);
+    if (beginNs)
+    {
+        float args[] = {start_x, start_y, start_z, end_x, end_y, end_z};
+        NavTraceFilter def;
+        trace.Record(nav->scene, nav->handle->resPath, NAV_TRACE_FIND_STRAIGHT_PATH, args, 6, pos, beginNs,
+                     trace_filter(nav, filter, def), quality.epsilon, quality.maxNodes);
+    }
     if (pos <= 0)
     {
         lua_pushboolean(L, false);
@@ -137,9 +245,64 @@ lFindStraightPath(lua_State *L)
 
         lua_rawseti(L, -2, i + 1);
     }
+    lua_pushinteger(L, flags);
+    return 3;
+}
+
+static int
+lFindStraightPathPacked(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float start_x = luaL_checknumber(L, 2);
+    float start_y = luaL_checknumber(L, 3);
+    float start_z = luaL_checknumber(L, 4);
+
+    float end_x = luaL_checknumber(L, 5);
+    float end_y = luaL_checknumber(L, 6);
+    float end_z = luaL_checknumber(L, 7);
+
+    float step = luaL_optnumber(L, 8, 0.1);
+    luaL_argcheck(L, step > 0, 8, "step should be positive");
+    bool with_flags = lua_toboolean(L, 9);
+
+    RecastNavigationHandle::PathQuality quality;
+    read_path_quality(L, 10, quality);
+    int filter = check_filter(L, 12, nav);
+
+    NFVector3 start(start_x, start_y, start_z);
+    NFVector3 end(end_x, end_y, end_z);
+
+    std::string packed;
+    int flags = 0;
+    NavTraceWriter &trace = NavTraceWriter::Instance();
+    uint64_t beginNs = trace.IsOpen() ? NavTraceWriter::Now() : 0;
+    int pos = nav->handle->FindStraightPathPacked(start, end, step, with_flags, packed, quality, &flags, filter);
+    if (beginNs)
+    {
+        float args[] = {start_x, start_y, start_z, end_x, end_y, end_z};
+        NavTraceFilter def;
+        trace.Record(nav->scene, nav->handle->resPath, NAV_TRACE_FIND_STRAIGHT_PATH, args, 6, pos, beginNs,
+                     trace_filter(nav, filter, def), quality.epsilon, quality.maxNodes);
+    }
+    if (pos <= 0)
+    {
+        lua_pushboolean(L, false);
+        lua_pushinteger(L, pos);
+        return 2;
+    }
+    lua_pushlstring(L, packed.data(), packed.size());
+    lua_pushinteger(L, flags);
     return 2;
 }
 
+static int
+lGetOrigin(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    const float *orig = nav->handle->GetOrigin();
+    return push_vector3(L, NFVector3(orig[0], orig[1], orig[2]));
+}
+
 static int
 lFindRandomPointAroundCircle(lua_State *L)
 {
@@ -150,11 +313,21 @@ lFindRandomPointAroundCircle(lua_State *L)
 
     int max_points = luaL_checknumber(L, 5);
     float maxRadius = luaL_checknumber(L, 6);
+    int filter = check_filter(L, 7, nav);
 
     NFVector3 center(center_x, center_y, center_z);
     std::vector<NFVector3> paths;
 
-    int size = nav->handle->FindRandomPointAroundCircle(center, paths, max_points, maxRadius);
+    NavTraceWriter &trace = NavTraceWriter::Instance();
+    uint64_t beginNs = trace.IsOpen() ? NavTraceWriter::Now() : 0;
+    int size = nav->handle->FindRandomPointAroundCircle(center, paths, max_points, maxRadius, filter);
+    if (beginNs)
+    {
+        float args[] = {center_x, center_y, center_z, (float)max_points, maxRadius};
+        NavTraceFilter def;
+        trace.Record(nav->scene, nav->handle->resPath, NAV_TRACE_FIND_RANDOM_POINT_AROUND_CIRCLE, args, 5, size, beginNs,
+                     trace_filter(nav, filter, def));
+    }
     if (size <= 0)
     {
         lua_pushboolean(L, false);
@@ -192,12 +365,21 @@ lRaycast(lua_State *L)
     float end_x = luaL_checknumber(L, 5);
     float end_y = luaL_checknumber(L, 6);
     float end_z = luaL_checknumber(L, 7);
+    int filter = check_filter(L, 8, nav);
 
     NFVector3 start(start_x, start_y, start_z);
     NFVector3 end(end_x, end_y, end_z);
 
     std::vector<NFVector3> hitPointVec;
-    int res = nav->handle->Raycast(start, end, hitPointVec);
+    NavTraceWriter &trace = NavTraceWriter::Instance();
+    uint64_t beginNs = trace.IsOpen() ? NavTraceWriter::Now() : 0;
+    int res = nav->handle->Raycast(start, end, hitPointVec, filter);
+    if (beginNs)
+    {
+        float args[] = {start_x, start_y, start_z, end_x, end_y, end_z};
+        NavTraceFilter def;
+        trace.Record(nav->scene, nav->handle->resPath, NAV_TRACE_RAYCAST, args, 6, res, beginNs, trace_filter(nav, filter, def));
+    }
     lua_pushinteger(L, res);
     lua_newtable(L);
     for (size_t i = 0; i < hitPointVec.size(); i++)
@@ -215,17 +397,457 @@ lRaycast(lua_State *L)
     return 2;
 }
 
+static int
+lIsReachable(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float start_x = luaL_checknumber(L, 2);
+    float start_y = luaL_checknumber(L, 3);
+    float start_z = luaL_checknumber(L, 4);
+
+    float end_x = luaL_checknumber(L, 5);
+    float end_y = luaL_checknumber(L, 6);
+    float end_z = luaL_checknumber(L, 7);
+
+    int filter = check_filter(L, 8, nav);
+
+    NFVector3 start(start_x, start_y, start_z);
+    NFVector3 end(end_x, end_y, end_z);
+
+    lua_pushboolean(L, nav->handle->IsReachable(start, end, filter) > 0);
+    return 1;
+}
+
+// reads a flat {x1, y1, z1, x2, y2, z2, ...} table
+static void
+read_points(lua_State *L, int idx, std::vector<NFVector3> &points)
+{
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    int n = (int)lua_rawlen(L, idx) / 3;
+    points.reserve(n);
+    for (int i = 0; i < n; i++)
+    {
+        lua_rawgeti(L, idx, i * 3 + 1);
+        lua_rawgeti(L, idx, i * 3 + 2);
+        lua_rawgeti(L, idx, i * 3 + 3);
+        points.push_back(NFVector3((float)lua_tonumber(L, -3), (float)lua_tonumber(L, -2), (float)lua_tonumber(L, -1)));
+        lua_pop(L, 3);
+    }
+}
+
+static int
+lFindWithinWalkingDistance(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float x = luaL_checknumber(L, 2);
+    float y = luaL_checknumber(L, 3);
+    float z = luaL_checknumber(L, 4);
+    float max_dist = luaL_checknumber(L, 5);
+    int filter = check_filter(L, 7, nav);
+
+    std::vector<NFVector3> candidates;
+    read_points(L, 6, candidates);
+
+    std::vector<float> costs;
+    int found = nav->handle->FindWalkingDistances(NFVector3(x, y, z), candidates, max_dist, false, costs, filter);
+    if (found <= 0)
+    {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+
+    lua_pushboolean(L, true);
+    lua_createtable(L, (int)costs.size(), 0);
+    for (size_t i = 0; i < costs.size(); i++)
+    {
+        if (costs[i] >= 0)
+            lua_pushnumber(L, costs[i]);
+        else
+            lua_pushboolean(L, false);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 2;
+}
+
+static int
+lFindNearestReachable(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float x = luaL_checknumber(L, 2);
+    float y = luaL_checknumber(L, 3);
+    float z = luaL_checknumber(L, 4);
+    float max_dist = luaL_checknumber(L, 5);
+    int filter = check_filter(L, 7, nav);
+
+    std::vector<NFVector3> candidates;
+    read_points(L, 6, candidates);
+
+    std::vector<float> costs;
+    if (nav->handle->FindWalkingDistances(NFVector3(x, y, z), candidates, max_dist, true, costs, filter) <= 0)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    for (size_t i = 0; i < costs.size(); i++)
+    {
+        if (costs[i] >= 0)
+        {
+            lua_pushinteger(L, i + 1);
+            lua_pushnumber(L, costs[i]);
+            return 2;
+        }
+    }
+
+    lua_pushnil(L);
+    return 1;
+}
+
+static int
+lGetHeight(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float x = luaL_checknumber(L, 2);
+    float z = luaL_checknumber(L, 3);
+
+    float height;
+    int res;
+    if (lua_isnoneornil(L, 4))
+    {
+        res = nav->handle->GetHeight(x, z, &height);
+    }
+    else
+    {
+        float hint = luaL_checknumber(L, 4);
+        res = nav->handle->GetHeight(x, z, &height, &hint);
+    }
+
+    if (res <= 0)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushnumber(L, height);
+    return 1;
+}
+
+static int
+lGetHeights(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    int n = (int)lua_rawlen(L, 2) / 2;
+    lua_createtable(L, n, 0);
+    for (int i = 0; i < n; i++)
+    {
+        lua_rawgeti(L, 2, i * 2 + 1);
+        float x = lua_tonumber(L, -1);
+        lua_rawgeti(L, 2, i * 2 + 2);
+        float z = lua_tonumber(L, -1);
+        lua_pop(L, 2);
+
+        float height;
+        if (nav->handle->GetHeight(x, z, &height) > 0)
+            lua_pushnumber(L, height);
+        else
+            lua_pushboolean(L, false);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+struct s_path
+{
+    RecastNavigationPath *path;
+};
+
+static int
+lFindPath(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float start_x = luaL_checknumber(L, 2);
+    float start_y = luaL_checknumber(L, 3);
+    float start_z = luaL_checknumber(L, 4);
+
+    float end_x = luaL_checknumber(L, 5);
+    float end_y = luaL_checknumber(L, 6);
+    float end_z = luaL_checknumber(L, 7);
+
+    int filter = check_filter(L, 8, nav);
+
+    NFVector3 start(start_x, start_y, start_z);
+    NFVector3 end(end_x, end_y, end_z);
+
+    // the userdata owns the path from the moment it is allocated, nothing may
+    // raise a Lua error between new and the store
+    struct s_path *p = (struct s_path *)lua_newuserdata(L, sizeof(struct s_path));
+    p->path = NULL;
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_setmetatable(L, -2);
+
+    // the path uses the navmesh handle, keep the navmesh alive as long as the path
+    lua_pushvalue(L, 1);
+    lua_setuservalue(L, -2);
+
+    p->path = new RecastNavigationPath(nav->handle, filter);
+    if (p->path->Init(start, end) <= 0)
+    {
+        delete p->path;
+        p->path = NULL;
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int
+lpath_release(lua_State *L)
+{
+    struct s_path *p = (struct s_path *)check_userdata(L, 1);
+    if (p->path)
+    {
+        delete p->path;
+        p->path = NULL;
+    }
+    return 0;
+}
+
+static int
+lPathAdvance(lua_State *L)
+{
+    struct s_path *p = (struct s_path *)check_userdata(L, 1);
+    float x = luaL_checknumber(L, 2);
+    float y = luaL_checknumber(L, 3);
+    float z = luaL_checknumber(L, 4);
+
+    return push_vector3(L, p->path->Advance(NFVector3(x, y, z)));
+}
+
+static int
+lPathCorners(lua_State *L)
+{
+    struct s_path *p = (struct s_path *)check_userdata(L, 1);
+    int max_corners = luaL_optinteger(L, 2, 3);
+
+    std::vector<NFVector3> corners;
+    bool end = p->path->GetCorners(max_corners, corners);
+
+    lua_createtable(L, (int)corners.size(), 0);
+    for (size_t i = 0; i < corners.size(); i++)
+    {
+        lua_createtable(L, 3, 0);
+        lua_pushnumber(L, corners[i].X());
+        lua_rawseti(L, -2, 1);
+        lua_pushnumber(L, corners[i].Y());
+        lua_rawseti(L, -2, 2);
+        lua_pushnumber(L, corners[i].Z());
+        lua_rawseti(L, -2, 3);
+
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushboolean(L, end);
+    return 2;
+}
+
+static int
+lPathRetarget(lua_State *L)
+{
+    struct s_path *p = (struct s_path *)check_userdata(L, 1);
+    float x = luaL_checknumber(L, 2);
+    float y = luaL_checknumber(L, 3);
+    float z = luaL_checknumber(L, 4);
+
+    lua_pushboolean(L, p->path->Retarget(NFVector3(x, y, z)) > 0);
+    return 1;
+}
+
+static int
+lPathPosition(lua_State *L)
+{
+    struct s_path *p = (struct s_path *)check_userdata(L, 1);
+    return push_vector3(L, p->path->GetPosition());
+}
+
+static int
+lPathTarget(lua_State *L)
+{
+    struct s_path *p = (struct s_path *)check_userdata(L, 1);
+    return push_vector3(L, p->path->GetTarget());
+}
+
+static void
+lpath(lua_State *L)
+{
+    luaL_Reg l[] = {
+        {"Advance", lPathAdvance},
+        {"Corners", lPathCorners},
+        {"Retarget", lPathRetarget},
+        {"Position", lPathPosition},
+        {"Target", lPathTarget},
+        {NULL, NULL},
+    };
+    create_meta(L, l, "navpath", NULL, lpath_release);
+}
+
+static int
+ltrace_open(lua_State *L)
+{
+    const char *path = luaL_checkstring(L, 1);
+    lua_pushboolean(L, NavTraceWriter::Instance().Open(path));
+    return 1;
+}
+
+static int
+ltrace_close(lua_State *L)
+{
+    NavTraceWriter::Instance().Close();
+    return 0;
+}
+
+static int
+lHasLineOfSight(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float start_x = luaL_checknumber(L, 2);
+    float start_y = luaL_checknumber(L, 3);
+    float start_z = luaL_checknumber(L, 4);
+
+    float end_x = luaL_checknumber(L, 5);
+    float end_y = luaL_checknumber(L, 6);
+    float end_z = luaL_checknumber(L, 7);
+    int filter = check_filter(L, 8, nav);
+    bool approximate = lua_toboolean(L, 9);
+
+    NFVector3 start(start_x, start_y, start_z);
+    NFVector3 end(end_x, end_y, end_z);
+
+    int res = nav->handle->HasLineOfSight(start, end, filter, approximate);
+    if (res < 0)
+    {
+        lua_pushnil(L);
+        lua_pushinteger(L, res);
+        return 2;
+    }
+    lua_pushboolean(L, res);
+    return 1;
+}
+
+static int
+lIsVisibilityReady(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    const NavVisibility *visibility = nav->handle->GetVisibility();
+    lua_pushboolean(L, visibility && visibility->IsReady());
+    return 1;
+}
+
+static int
+lAddFilter(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    lua_getfield(L, 2, "include");
+    int include_flags = luaL_optinteger(L, -1, 0xffff);
+    lua_pop(L, 1);
+
+    lua_getfield(L, 2, "exclude");
+    int exclude_flags = luaL_optinteger(L, -1, 0);
+    lua_pop(L, 1);
+
+    // costs = { [area] = cost, ... }, missing areas cost 1
+    float costs[DT_MAX_AREAS];
+    for (int i = 0; i < DT_MAX_AREAS; i++)
+        costs[i] = 1.0f;
+
+    lua_getfield(L, 2, "costs");
+    if (!lua_isnil(L, -1))
+    {
+        luaL_checktype(L, -1, LUA_TTABLE);
+        lua_pushnil(L);
+        while (lua_next(L, -2) != 0)
+        {
+            int area = luaL_checkinteger(L, -2);
+            luaL_argcheck(L, area >= 0 && area < DT_MAX_AREAS, 2, "area out of range");
+            costs[area] = luaL_checknumber(L, -1);
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+
+    lua_pushinteger(L, nav->handle->AddFilter((unsigned short)include_flags, (unsigned short)exclude_flags, costs));
+    return 1;
+}
+
+static int
+lSetPolyFlags(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    float center_x = luaL_checknumber(L, 2);
+    float center_y = luaL_checknumber(L, 3);
+    float center_z = luaL_checknumber(L, 4);
+
+    float extent_x = luaL_checknumber(L, 5);
+    float extent_y = luaL_checknumber(L, 6);
+    float extent_z = luaL_checknumber(L, 7);
+
+    int flags = luaL_checkinteger(L, 8);
+
+    NFVector3 center(center_x, center_y, center_z);
+    NFVector3 extents(extent_x, extent_y, extent_z);
+
+    lua_pushinteger(L, nav->handle->SetPolyFlags(center, extents, (unsigned short)flags));
+    return 1;
+}
+
+static int
+lResetPolyFlags(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    nav->handle->ResetPolyFlags();
+    return 0;
+}
+
+static int
+lGetInstanceMemory(lua_State *L)
+{
+    struct s_navigation *nav = (struct s_navigation *)check_userdata(L, 1);
+    lua_pushinteger(L, (lua_Integer)nav->handle->overlay.GetMemorySize());
+    lua_pushinteger(L, (lua_Integer)nav->handle->shared.use_count());
+    return 2;
+}
+
 static void
 lnavmesh(lua_State *L)
 {
     luaL_Reg l[] = {
         {"FindStraightPath", lFindStraightPath},
+        {"FindStraightPathPacked", lFindStraightPathPacked},
+        {"GetOrigin", lGetOrigin},
         {"FindRandomPointAroundCircle", lFindRandomPointAroundCircle},
         {"Raycast", lRaycast},
+        {"IsReachable", lIsReachable},
+        {"FindWithinWalkingDistance", lFindWithinWalkingDistance},
+        {"FindNearestReachable", lFindNearestReachable},
+        {"GetHeight", lGetHeight},
+        {"GetHeights", lGetHeights},
+        {"HasLineOfSight", lHasLineOfSight},
+        {"IsVisibilityReady", lIsVisibilityReady},
+        {"AddFilter", lAddFilter},
+        {"SetPolyFlags", lSetPolyFlags},
+        {"ResetPolyFlags", lResetPolyFlags},
+        {"GetInstanceMemory", lGetInstanceMemory},
         {NULL, NULL},
     };
     create_meta(L, l, "navmesh", NULL, lrelease);
-    lua_pushcclosure(L, lnew, 1);
+
+    // FindPath creates path objects, it carries their metatable as upvalue
+    lua_getfield(L, -1, "__index");
+    lpath(L);
+    lua_pushcclosure(L, lFindPath, 1);
+    lua_setfield(L, -2, "FindPath");
+    lua_pop(L, 1);
 }
 
 LUAMOD_API int
@@ -235,7 +857,24 @@ luaopen_recastnavigation(lua_State *L)
     lua_newtable(L);
 
     lnavmesh(L);
-    lua_setfield(L, -2, "navmesh");
+    lua_pushvalue(L, -1);
+    lua_pushcclosure(L, lnew, 1);
+    lua_setfield(L, -3, "navmesh");
+    lua_pushboolean(L, 1);
+    lua_pushcclosure(L, lnew, 2);
+    lua_setfield(L, -2, "instance");
+
+    lua_pushinteger(L, RecastNavigationHandle::NAV_PATH_APPROXIMATE);
+    lua_setfield(L, -2, "PATH_APPROXIMATE");
+    lua_pushinteger(L, RecastNavigationHandle::NAV_PATH_PARTIAL);
+    lua_setfield(L, -2, "PATH_PARTIAL");
+    lua_pushinteger(L, RecastNavigationHandle::NAV_PATH_OUT_OF_NODES);
+    lua_setfield(L, -2, "PATH_OUT_OF_NODES");
+
+    lua_pushcfunction(L, ltrace_open);
+    lua_setfield(L, -2, "trace_open");
+    lua_pushcfunction(L, ltrace_close);
+    lua_setfield(L, -2, "trace_close");
 
     return 1;
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+// Offline replayer for query traces recorded with recastnavigation.trace_open().
+//
+// usage: recastnavigation-replay [--reorder] <trace> <navmesh> [threads] [scene]
+//
+// Every recorded FindStraightPath / FindRandomPointAroundCircle / Raycast call
+// (optionally only those of one scene) is replayed against <navmesh> with the
+// recorded filter profile and path quality; a trace recorded on several
+// navmeshes must be narrowed to one scene. Records are
+// dealt round-robin to the worker threads, each owning its own handle since a
+// dtNavMeshQuery must not be shared between threads. Straight paths are also
+// round tripped through the packed path codec. --reorder loads the navmesh with
+// Morton reordered tiles, run with and without it to compare.
+
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+
+#include "recastnavigation.h"
+#include "recastnavigation_trace.h"
+
+static_assert(NAV_TRACE_AREAS == DT_MAX_AREAS, "trace filters must hold one cost per area");
+
+struct ReplayResult
+{
+	uint32_t latencyNs;
+	bool mismatch;
+};
+
+// Round trips a straight path through NavPathEncode / NavPathDecode.
+static bool CheckPacked(RecastNavigationHandle *handle, const std::vector<NFVector3> &path)
+{
+	const float step = 0.1f;
+
+	std::vector<float> points;
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		points.push_back(path[i].X());
+		points.push_back(path[i].Y());
+		points.push_back(path[i].Z());
+	}
+
+	std::string packed;
+	NavPathEncode(handle->GetOrigin(), step, points.data(), (int)path.size(), NULL, packed);
+
+	std::vector<float> decoded;
+	if (!NavPathDecode(packed.data(), packed.size(), handle->GetOrigin(), decoded, NULL) || decoded.size() != points.size())
+		return false;
+
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		if (fabsf(decoded[i] - points[i]) > step * 0.5f + 1e-3f)
+			return false;
+	}
+	return true;
+}
+
+static void ReplayWorker(RecastNavigationHandle *handle, const std::vector<NavTraceRecord> *records, size_t first, size_t step, std::vector<ReplayResult> *results)
+{
+	std::vector<NFVector3> out;
+	for (size_t i = first; i < records->size(); i += step)
+	{
+		const NavTraceRecord &rec = (*records)[i];
+		const float *a = rec.args;
+
+		out.clear();
+		uint64_t beginNs = NavTraceWriter::Now();
+
+		RecastNavigationHandle::PathQuality quality;
+		quality.epsilon = rec.epsilon;
+		if (rec.maxNodes > 0)
+			quality.maxNodes = rec.maxNodes;
+
+		int res = 0;
+		switch (rec.op)
+		{
+		case NAV_TRACE_FIND_STRAIGHT_PATH:
+			res = handle->FindStraightPath(NFVector3(a[0], a[1], a[2]), NFVector3(a[3], a[4], a[5]), out, quality, NULL, rec.filter);
+			break;
+		case NAV_TRACE_FIND_RANDOM_POINT_AROUND_CIRCLE:
+			res = handle->FindRandomPointAroundCircle(NFVector3(a[0], a[1], a[2]), out, (int)a[3], a[4], rec.filter);
+			break;
+		case NAV_TRACE_RAYCAST:
+			res = handle->Raycast(NFVector3(a[0], a[1], a[2]), NFVector3(a[3], a[4], a[5]), out, rec.filter);
+			break;
+		}
+
+		ReplayResult &r = (*results)[i];
+		r.latencyNs = (uint32_t)std::min<uint64_t>(NavTraceWriter::Now() - beginNs, UINT32_MAX);
+		// random points are not reproducible, only compare deterministic queries
+		r.mismatch = rec.op != NAV_TRACE_FIND_RANDOM_POINT_AROUND_CIRCLE && res != rec.result;
+
+		if (rec.op == NAV_TRACE_FIND_STRAIGHT_PATH && res > 0 && !CheckPacked(handle, out))
+			r.mismatch = true;
+	}
+}
+
+static uint32_t Percentile(std::vector<uint32_t> &v, double p)
+{
+	if (v.empty())
+		return 0;
+
+	size_t k = std::min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5));
+	std::nth_element(v.begin(), v.begin() + k, v.end());
+	return v[k];
+}
+
+static double Mean(const std::vector<uint32_t> &v)
+{
+	double sum = 0;
+	for (size_t i = 0; i < v.size(); i++)
+		sum += v[i];
+	return v.empty() ? 0 : sum / v.size();
+}
+
+int main(int argc, char **argv)
+{
+	RecastNavigationHandle::CreateOptions options;
+	if (argc > 1 && strcmp(argv[1], "--reorder") == 0)
+	{
+		options.reorderTiles = true;
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
+
+	if (argc < 3)
+	{
+		printf("usage: %s [--reorder] <trace> <navmesh> [threads] [scene]\n", argv[0]);
+		return 1;
+	}
+
+	int threads = argc > 3 ? std::max(1, atoi(argv[3])) : 1;
+	bool filterScene = argc > 4;
+	int64_t scene = filterScene ? strtoll(argv[4], NULL, 10) : 0;
+
+	std::vector<NavTraceRecord> all;
+	std::unordered_map<int64_t, std::string> scenes;
+	std::vector<NavTraceFilter> filters;
+	if (!NavTraceLoad(argv[1], all, scenes, filters))
+		return 1;
+
+	for (auto it = scenes.begin(); it != scenes.end(); ++it)
+		printf("trace scene [%lld] => {%s}\n", (long long)it->first, it->second.c_str());
+
+	std::vector<NavTraceRecord> records;
+	for (size_t i = 0; i < all.size(); i++)
+	{
+		if (!filterScene || all[i].scene == scene)
+			records.push_back(all[i]);
+	}
+
+	if (records.empty())
+	{
+		printf("no query to replay\n");
+		return 1;
+	}
+
+	// every record is replayed against <navmesh>, which only makes sense when
+	// they were all recorded on one map
+	std::string recordedPath;
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const std::string &path = scenes[records[i].scene];
+		if (i > 0 && path != recordedPath)
+		{
+			printf("trace covers several navmeshes ({%s}, {%s}), pass [scene] to replay one of them\n", recordedPath.c_str(), path.c_str());
+			return 1;
+		}
+		recordedPath = path;
+	}
+
+	std::vector<RecastNavigationHandle *> handles;
+	for (int i = 0; i < threads; i++)
+	{
+		RecastNavigationHandle *handle = RecastNavigationHandle::Create(argv[2], options);
+		if (!handle)
+			return 1;
+
+		// same order as NavTraceLoad numbered them
+		for (size_t k = 0; k < filters.size(); k++)
+			handle->AddFilter(filters[k].includeFlags, filters[k].excludeFlags, filters[k].areaCosts);
+		handles.push_back(handle);
+	}
+
+	std::vector<ReplayResult> results(records.size());
+
+	uint64_t beginNs = NavTraceWriter::Now();
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(ReplayWorker, handles[i], &records, (size_t)i, (size_t)threads, &results));
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	double wallMs = (NavTraceWriter::Now() - beginNs) / 1e6;
+
+	printf("replayed %d queries on %d thread(s) in %.2f ms (%.0f queries/s)\n",
+		   (int)records.size(), threads, wallMs, records.size() / (wallMs / 1000.0));
+	printf("%-28s %8s %10s %10s %10s %10s %10s %10s %8s\n", "op", "count",
+		   "rec.avg", "rec.p50", "rec.p99", "avg", "p50", "p99", "mismatch");
+
+	for (int op = NAV_TRACE_FIND_STRAIGHT_PATH; op < NAV_TRACE_OP_COUNT; op++)
+	{
+		std::vector<uint32_t> recorded, replayed;
+		int mismatch = 0;
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			if (records[i].op != op)
+				continue;
+
+			recorded.push_back(records[i].latencyNs);
+			replayed.push_back(results[i].latencyNs);
+			mismatch += results[i].mismatch ? 1 : 0;
+		}
+
+		if (recorded.empty())
+			continue;
+
+		// latencies in microseconds
+		printf("%-28s %8d %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %8d\n", NavTraceOpName(op), (int)recorded.size(),
+			   Mean(recorded) / 1000.0, Percentile(recorded, 0.5) / 1000.0, Percentile(recorded, 0.99) / 1000.0,
+			   Mean(replayed) / 1000.0, Percentile(replayed, 0.5) / 1000.0, Percentile(replayed, 0.99) / 1000.0, mismatch);
+	}
+
+	for (size_t i = 0; i < handles.size(); i++)
+		delete handles[i];
+
+	return 0;
+}
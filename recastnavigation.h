@@ -4,11 +4,23 @@
 #include <iostream>
 #include <vector>
 #include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
 
 #include "DetourNavMeshBuilder.h"
 #include "DetourNavMeshQuery.h"
 #include "DetourCommon.h"
 #include "DetourNavMesh.h"
+#include "DetourPathCorridor.h"
+
+#include "recastnavigation_pathcodec.h"
 
 // https://github.com/ketoo/NoahGameFrame/blob/master/NFComm/NFNavigationPlugin
 
@@ -310,299 +322,2825 @@ public:
 	}
 };
 
-class RecastNavigationHandle
+/**
+ * Walkable ground heights sampled on a regular XZ grid at load time.
+ * Every grid vertex keeps all walkable layers found above it (CSR layout:
+ * heights[offsets[i]..offsets[i+1]) sorted bottom-up), so a lookup in a single
+ * layer cell is a bilinear blend of its four corners. A bit per cell records
+ * whether any poly's bounds overlap it; only cells without one are a fast miss,
+ * a narrow walkway crossing a cell between its corners goes to the exact query.
+ */
+class NavHeightGrid
 {
 public:
-	static const int NAV_ERROR = -1;
-
-	static const int MAX_POLYS = 256;
-	static const int NAV_ERROR_NEARESTPOLY = -2;
-
-	static const long RCN_NAVMESH_VERSION = 1;
-	static const int INVALID_NAVMESH_POLYREF = 0;
-
-	struct NavmeshLayer
+	enum
 	{
-		dtNavMesh *pNavmesh;
-		dtNavMeshQuery *pNavmeshQuery;
+		SAMPLE_MISS = 0,	  // no poly overlaps the cell
+		SAMPLE_OK = 1,		  // single layer, height interpolated
+		SAMPLE_AMBIGUOUS = 2, // multiple layers, steps, partial or no corner coverage
 	};
 
-public:
-	RecastNavigationHandle(){};
+	static const int MAX_VERTICES = 64 * 1024 * 1024;
 
-	virtual ~RecastNavigationHandle()
+	NavHeightGrid() : cellSize(0), invCellSize(0), climb(0), width(0), height(0)
 	{
-		dtFreeNavMesh(navmeshLayer.pNavmesh);
-		dtFreeNavMeshQuery(navmeshLayer.pNavmeshQuery);
-	};
+		orig[0] = orig[1] = 0;
+	}
 
-	int FindStraightPath(const NFVector3 &start, const NFVector3 &end, std::vector<NFVector3> &paths)
+	bool Build(const dtNavMesh *mesh, const dtNavMeshQuery *query, const float *bmin, const float *bmax, float cs)
 	{
-		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
-
-		float spos[3];
-		spos[0] = start.X();
-		spos[1] = start.Y();
-		spos[2] = start.Z();
-
-		float epos[3];
-		epos[0] = end.X();
-		epos[1] = end.Y();
-		epos[2] = end.Z();
+		cellSize = cs;
+		invCellSize = 1.0f / cs;
+		orig[0] = bmin[0];
+		orig[1] = bmin[2];
+		width = (int)ceilf((bmax[0] - bmin[0]) * invCellSize) + 1;
+		height = (int)ceilf((bmax[2] - bmin[2]) * invCellSize) + 1;
+
+		if ((int64_t)width * height > MAX_VERTICES)
+		{
+			printf("NavHeightGrid::Build: cell size({%f}) is too small, {%d}x{%d} vertices!\n", cs, width, height);
+			return false;
+		}
 
 		dtQueryFilter filter;
 		filter.setIncludeFlags(0xffff);
 		filter.setExcludeFlags(0);
 
-		const float extents[3] = {2.f, 4.f, 2.f};
-
-		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
-		dtPolyRef endRef = INVALID_NAVMESH_POLYREF;
+		std::vector<std::pair<uint32_t, float>> samples;
+		climb = 0.01f;
 
-		float startNearestPt[3];
-		float endNearestPt[3];
-		navmeshQuery->findNearestPoly(spos, extents, &filter, &startRef, startNearestPt);
-		navmeshQuery->findNearestPoly(epos, extents, &filter, &endRef, endNearestPt);
+		// cell (x, z) spans vertices x..x+1, z..z+1
+		const int cellsX = width - 1;
+		occupied.assign(((size_t)cellsX * (height - 1) + 63) / 64, 0);
 
-		if (!startRef || !endRef)
+		for (int i = 0; i < mesh->getMaxTiles(); ++i)
 		{
-			//debuf_msg("NavMeshHandle::findStraightPath({%s}): Could not find any nearby poly's ({%d}, {%d})\n", resPath.c_str(), startRef, endRef);
-			return NAV_ERROR_NEARESTPOLY;
-		}
-
-		dtPolyRef polys[MAX_POLYS];
-		int npolys;
-		float straightPath[MAX_POLYS * 3];
-		unsigned char straightPathFlags[MAX_POLYS];
-		dtPolyRef straightPathPolys[MAX_POLYS];
-		int nstraightPath;
-		int pos = 0;
+			const dtMeshTile *tile = mesh->getTile(i);
+			if (!tile || !tile->header)
+				continue;
 
-		navmeshQuery->findPath(startRef, endRef, startNearestPt, endNearestPt, &filter, polys, &npolys, MAX_POLYS);
-		nstraightPath = 0;
+			climb = dtMax(climb, tile->header->walkableClimb);
+			dtPolyRef base = mesh->getPolyRefBase(tile);
 
-		if (npolys)
-		{
-			float epos1[3];
-			dtVcopy(epos1, endNearestPt);
+			for (int j = 0; j < tile->header->polyCount; ++j)
+			{
+				const dtPoly *poly = &tile->polys[j];
+				if (poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+					continue;
+				if (!filter.passFilter(base | (dtPolyRef)j, tile, poly))
+					continue;
+
+				float verts[DT_VERTS_PER_POLYGON * 3];
+				float pmin[3], pmax[3];
+				const int nv = (int)poly->vertCount;
+				for (int k = 0; k < nv; ++k)
+					dtVcopy(&verts[k * 3], &tile->verts[poly->verts[k] * 3]);
+				dtVcopy(pmin, verts);
+				dtVcopy(pmax, verts);
+				for (int k = 1; k < nv; ++k)
+				{
+					dtVmin(pmin, &verts[k * 3]);
+					dtVmax(pmax, &verts[k * 3]);
+				}
 
-			if (polys[npolys - 1] != endRef)
-				navmeshQuery->closestPointOnPoly(polys[npolys - 1], endNearestPt, epos1, 0);
+				const int cx0 = dtMax(0, (int)floorf((pmin[0] - orig[0]) * invCellSize));
+				const int cx1 = dtMin(cellsX - 1, (int)floorf((pmax[0] - orig[0]) * invCellSize));
+				const int cz0 = dtMax(0, (int)floorf((pmin[2] - orig[1]) * invCellSize));
+				const int cz1 = dtMin(height - 2, (int)floorf((pmax[2] - orig[1]) * invCellSize));
+				for (int z = cz0; z <= cz1; ++z)
+				{
+					for (int x = cx0; x <= cx1; ++x)
+					{
+						const size_t bit = (size_t)z * cellsX + x;
+						occupied[bit >> 6] |= 1ULL << (bit & 63);
+					}
+				}
 
-			navmeshQuery->findStraightPath(startNearestPt, endNearestPt, polys, npolys, straightPath, straightPathFlags, straightPathPolys, &nstraightPath, MAX_POLYS);
+				const int x0 = dtMax(0, (int)ceilf((pmin[0] - orig[0]) * invCellSize));
+				const int x1 = dtMin(width - 1, (int)floorf((pmax[0] - orig[0]) * invCellSize));
+				const int z0 = dtMax(0, (int)ceilf((pmin[2] - orig[1]) * invCellSize));
+				const int z1 = dtMin(height - 1, (int)floorf((pmax[2] - orig[1]) * invCellSize));
 
-			NFVector3 currpos;
-			for (int i = 0; i < nstraightPath * 3;)
-			{
-				currpos.SetX(straightPath[i++]);
-				currpos.SetY(straightPath[i++]);
-				currpos.SetZ(straightPath[i++]);
-				paths.push_back(currpos);
-				pos++;
+				for (int z = z0; z <= z1; ++z)
+				{
+					for (int x = x0; x <= x1; ++x)
+					{
+						float pt[3] = {orig[0] + x * cellSize, pmin[1], orig[1] + z * cellSize};
+						if (!dtPointInPolygon(pt, verts, nv))
+							continue;
+
+						float h = 0;
+						if (dtStatusFailed(query->getPolyHeight(base | (dtPolyRef)j, pt, &h)))
+							continue;
+
+						samples.push_back(std::make_pair((uint32_t)(z * width + x), h));
+					}
+				}
 			}
 		}
 
-		return pos;
-	}
-
-	int FindRandomPointAroundCircle(const NFVector3 &centerPos, std::vector<NFVector3> &points, int maxPoints, float maxRadius)
-	{
-		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
-
-		dtQueryFilter filter;
-		filter.setIncludeFlags(0xffff);
-		filter.setExcludeFlags(0);
+		std::sort(samples.begin(), samples.end());
 
-		if (maxRadius <= 0.0001f)
+		// Vertices on shared poly edges are sampled once per poly, merge
+		// heights closer than the walkable climb into one layer.
+		offsets.assign((size_t)width * height + 1, 0);
+		heights.clear();
+		heights.reserve(samples.size());
+		for (size_t i = 0; i < samples.size(); ++i)
 		{
-			NFVector3 currpos;
+			if (i > 0 && samples[i].first == samples[i - 1].first && samples[i].second - heights.back() <= climb)
+				continue;
 
-			for (int i = 0; i < maxPoints; i++)
-			{
-				float pt[3];
-				dtPolyRef ref;
-				dtStatus status = navmeshQuery->findRandomPoint(&filter, frand, &ref, pt);
-				if (dtStatusSucceed(status))
-				{
-					currpos.SetX(pt[0]);
-					currpos.SetY(pt[1]);
-					currpos.SetZ(pt[2]);
+			heights.push_back(samples[i].second);
+			offsets[samples[i].first + 1]++;
+		}
+		for (size_t i = 1; i < offsets.size(); ++i)
+			offsets[i] += offsets[i - 1];
 
-					points.push_back(currpos);
-				}
-			}
+		return true;
+	}
 
-			return (int)points.size();
-		}
+	int Sample(float x, float z, float *h, float *hint) const
+	{
+		const float fx = (x - orig[0]) * invCellSize;
+		const float fz = (z - orig[1]) * invCellSize;
+		if (fx < 0 || fz < 0 || fx >= width - 1 || fz >= height - 1)
+			return SAMPLE_MISS;
+
+		const int ix = (int)fx;
+		const int iz = (int)fz;
+		const size_t cell = (size_t)iz * (width - 1) + ix;
+		if (!(occupied[cell >> 6] >> (cell & 63) & 1))
+			return SAMPLE_MISS;
+
+		const uint32_t v[4] = {
+			(uint32_t)(iz * width + ix),
+			(uint32_t)(iz * width + ix + 1),
+			(uint32_t)((iz + 1) * width + ix),
+			(uint32_t)((iz + 1) * width + ix + 1),
+		};
+
+		float c[4];
+		int single = 0, covered = 0;
+		*hint = -FLT_MAX;
+		for (int i = 0; i < 4; ++i)
+		{
+			const uint32_t n = offsets[v[i] + 1] - offsets[v[i]];
+			if (n == 0)
+				continue;
 
-		const float extents[3] = {2.f, 4.f, 2.f};
+			covered++;
+			c[i] = heights[offsets[v[i]]];
+			*hint = dtMax(*hint, heights[offsets[v[i] + 1] - 1]);
+			if (n == 1)
+				single++;
+		}
 
-		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+		if (single != 4)
+			return SAMPLE_AMBIGUOUS;
 
-		float spos[3];
-		spos[0] = centerPos.X();
-		spos[1] = centerPos.Y();
-		spos[2] = centerPos.Z();
+		const float lo = dtMin(dtMin(c[0], c[1]), dtMin(c[2], c[3]));
+		const float hi = dtMax(dtMax(c[0], c[1]), dtMax(c[2], c[3]));
+		if (hi - lo > climb)
+			return SAMPLE_AMBIGUOUS;
 
-		float startNearestPt[3];
-		navmeshQuery->findNearestPoly(spos, extents, &filter, &startRef, startNearestPt);
+		const float tx = fx - ix;
+		const float tz = fz - iz;
+		const float h0 = c[0] + (c[1] - c[0]) * tx;
+		const float h1 = c[2] + (c[3] - c[2]) * tx;
+		*h = h0 + (h1 - h0) * tz;
+		return SAMPLE_OK;
+	}
 
-		if (!startRef)
-		{
-			//debuf_msg("NavMeshHandle::findRandomPointAroundCircle({%s}): Could not find any nearby poly's ({%d})\n", resPath, startRef);
-			return NAV_ERROR_NEARESTPOLY;
-		}
+	size_t GetMemorySize() const
+	{
+		return offsets.size() * sizeof(uint32_t) + heights.size() * sizeof(float) + occupied.size() * sizeof(uint64_t);
+	}
 
-		NFVector3 currpos;
-		bool done = false;
-		int itry = 0;
+	float cellSize;
+	float invCellSize;
+	float climb;
+	float orig[2];
+	int width;
+	int height;
+	std::vector<uint32_t> offsets;
+	std::vector<float> heights;
+	std::vector<uint64_t> occupied; // (width - 1) x (height - 1) cells, set when a poly overlaps
+};
 
-		while (itry++ < 3 && points.size() == 0)
-		{
-			maxPoints -= (int)points.size();
+/** Dense numbering of every poly of a navmesh, tile by tile, for per-poly tables. */
+class NavPolyIndex
+{
+public:
+	static const uint32_t INVALID = 0xffffffff;
 
-			for (int i = 0; i < maxPoints; i++)
-			{
-				float pt[3];
-				dtPolyRef ref;
-				dtStatus status = navmeshQuery->findRandomPointAroundCircle(startRef, spos, maxRadius, &filter, frand, &ref, pt);
+	NavPolyIndex() : mesh(NULL) {}
 
-				if (dtStatusSucceed(status))
-				{
-					done = true;
-					currpos.SetX(pt[0]);
-					currpos.SetY(pt[1]);
-					currpos.SetZ(pt[2]);
+	void Build(const dtNavMesh *navmesh)
+	{
+		mesh = navmesh;
+		tileBase.assign(mesh->getMaxTiles() + 1, 0);
+		refs.clear();
 
-					NFVector3 v = centerPos - currpos;
-					float dist_len = v.Length();
-					if (dist_len > maxRadius)
-						continue;
+		for (int i = 0; i < mesh->getMaxTiles(); ++i)
+		{
+			tileBase[i] = (uint32_t)refs.size();
 
-					points.push_back(currpos);
-				}
-			}
+			const dtMeshTile *tile = mesh->getTile(i);
+			if (!tile || !tile->header)
+				continue;
 
-			if (!done)
-				break;
+			dtPolyRef base = mesh->getPolyRefBase(tile);
+			for (int j = 0; j < tile->header->polyCount; ++j)
+				refs.push_back(base | (dtPolyRef)j);
 		}
+		tileBase[mesh->getMaxTiles()] = (uint32_t)refs.size();
+	}
 
-		return (int)points.size();
+	inline uint32_t Index(dtPolyRef ref) const
+	{
+		unsigned int salt, it, ip;
+		mesh->decodePolyId(ref, salt, it, ip);
+		return tileBase[it] + ip;
 	}
 
-	int Raycast(const NFVector3 &start, const NFVector3 &end, std::vector<NFVector3> &hitPointVec)
+	inline int Count() const
 	{
-		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
+		return (int)refs.size();
+	}
 
-		float hitPoint[3];
+	const dtNavMesh *mesh;
+	std::vector<uint32_t> tileBase;
+	std::vector<dtPolyRef> refs;
+};
 
-		float spos[3];
-		spos[0] = start.X();
-		spos[1] = start.Y();
-		spos[2] = start.Z();
+/**
+ * Connected components of the poly graph, links taken as undirected. Polys the
+ * default filter rejects get no component. Every other filter only removes
+ * polys, so two polys in different components are unreachable for any filter.
+ */
+class NavComponents
+{
+public:
+	static const uint32_t NONE = 0xffffffff;
 
-		float epos[3];
-		epos[0] = end.X();
-		epos[1] = end.Y();
-		epos[2] = end.Z();
+	NavComponents() : count(0) {}
 
+	void Build(const dtNavMesh *mesh, const NavPolyIndex &index)
+	{
 		dtQueryFilter filter;
 		filter.setIncludeFlags(0xffff);
 		filter.setExcludeFlags(0);
 
-		const float extents[3] = {2.f, 4.f, 2.f};
+		const int n = index.Count();
+		std::vector<uint32_t> parent(n);
+		for (int i = 0; i < n; ++i)
+			parent[i] = (uint32_t)i;
 
-		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+		labels.assign(n, NONE);
+		for (int i = 0; i < n; ++i)
+		{
+			const dtMeshTile *tile = NULL;
+			const dtPoly *poly = NULL;
+			mesh->getTileAndPolyByRefUnsafe(index.refs[i], &tile, &poly);
+			if (!filter.passFilter(index.refs[i], tile, poly))
+				continue;
 
-		float nearestPt[3];
-		navmeshQuery->findNearestPoly(spos, extents, &filter, &startRef, nearestPt);
+			labels[i] = 0;
+			for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+			{
+				const dtPolyRef neighbourRef = tile->links[k].ref;
+				if (!neighbourRef)
+					continue;
+
+				const dtMeshTile *neighbourTile = NULL;
+				const dtPoly *neighbourPoly = NULL;
+				mesh->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
+				if (!filter.passFilter(neighbourRef, neighbourTile, neighbourPoly))
+					continue;
+
+				uint32_t a = find(parent, (uint32_t)i);
+				uint32_t b = find(parent, index.Index(neighbourRef));
+				if (a != b)
+					parent[dtMax(a, b)] = dtMin(a, b);
+			}
+		}
 
-		if (!startRef)
+		// relabel roots to 0..count-1
+		count = 0;
+		std::vector<uint32_t> rootLabel(n, NONE);
+		for (int i = 0; i < n; ++i)
 		{
-			return NAV_ERROR_NEARESTPOLY;
-		}
+			if (labels[i] == NONE)
+				continue;
 
-		float t = 0;
-		float hitNormal[3];
-		memset(hitNormal, 0, sizeof(hitNormal));
+			uint32_t root = find(parent, (uint32_t)i);
+			if (rootLabel[root] == NONE)
+				rootLabel[root] = (uint32_t)count++;
+			labels[i] = rootLabel[root];
+		}
+	}
 
-		dtPolyRef polys[MAX_POLYS];
-		int npolys;
+	inline uint32_t Get(uint32_t index) const
+	{
+		return index < labels.size() ? labels[index] : NONE;
+	}
 
-		navmeshQuery->raycast(startRef, spos, epos, &filter, &t, hitNormal, polys, &npolys, MAX_POLYS);
+	int count;
+	std::vector<uint32_t> labels;
 
-		if (t > 1)
+private:
+	static uint32_t find(std::vector<uint32_t> &parent, uint32_t i)
+	{
+		while (parent[i] != i)
 		{
-			// no hit
-			return NAV_ERROR;
+			parent[i] = parent[parent[i]];
+			i = parent[i];
 		}
-		else
+		return i;
+	}
+};
+
+// Midpoint of the portal 'link' crosses from 'fromPoly' into 'toPoly', same as
+// dtNavMeshQuery::getEdgeMidPoint: off-mesh connections use their end vertex,
+// tile border portals are clamped to the link's [bmin, bmax] range.
+static void NavPortalMidpoint(dtPolyRef fromRef, const dtMeshTile *fromTile, const dtPoly *fromPoly, const dtLink &link,
+							  const dtMeshTile *toTile, const dtPoly *toPoly, float *mid)
+{
+	if (fromPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+	{
+		dtVcopy(mid, &fromTile->verts[fromPoly->verts[link.edge] * 3]);
+		return;
+	}
+
+	if (toPoly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+	{
+		for (unsigned int i = toPoly->firstLink; i != DT_NULL_LINK; i = toTile->links[i].next)
 		{
-			// Hit
-			hitPoint[0] = spos[0] + (epos[0] - spos[0]) * t;
-			hitPoint[1] = spos[1] + (epos[1] - spos[1]) * t;
-			hitPoint[2] = spos[2] + (epos[2] - spos[2]) * t;
-			if (npolys)
+			if (toTile->links[i].ref == fromRef)
 			{
-				float h = 0;
-				navmeshQuery->getPolyHeight(polys[npolys - 1], hitPoint, &h);
-				hitPoint[1] = h;
+				dtVcopy(mid, &toTile->verts[toPoly->verts[toTile->links[i].edge] * 3]);
+				return;
 			}
 		}
-
-		hitPointVec.push_back(NFVector3(hitPoint[0], hitPoint[1], hitPoint[2]));
-		return 1;
 	}
 
-	static RecastNavigationHandle *Create(std::string resPath)
+	const float *v0 = &fromTile->verts[fromPoly->verts[link.edge] * 3];
+	const float *v1 = &fromTile->verts[fromPoly->verts[(link.edge + 1) % (int)fromPoly->vertCount] * 3];
+	if (link.side != 0xff && (link.bmin != 0 || link.bmax != 255))
 	{
-		FILE *fp = fopen(resPath.c_str(), "rb");
-		if (!fp)
-		{
-			printf("RecastNavigationHandle::create: open({%s}) is error!\n", resPath.c_str());
-			return NULL;
-		}
+		const float s = 1.0f / 255.0f;
+		float left[3], right[3];
+		dtVlerp(left, v0, v1, link.bmin * s);
+		dtVlerp(right, v0, v1, link.bmax * s);
+		dtVlerp(mid, left, right, 0.5f);
+		return;
+	}
+	dtVlerp(mid, v0, v1, 0.5f);
+}
 
-		printf("RecastNavigationHandle::create: ({%s}), layer={%d}\n", resPath.c_str(), 0);
+/**
+ * Scratch state for the searches the handle runs over the poly graph itself.
+ * Nodes are addressed by NavPolyIndex; a generation stamp makes Reset() O(1),
+ * and the open list is a binary heap with lazy deletion of stale entries.
+ */
+class NavGraphSearch
+{
+public:
+	enum
+	{
+		NODE_OPEN = 1,
+		NODE_CLOSED = 2,
+	};
 
-		bool safeStorage = true;
-		int pos = 0;
-		int size = sizeof(NavMeshSetHeader);
+	struct Node
+	{
+		float pos[3];
+		float cost;
+		float total;
+		uint32_t parent;
+		uint32_t stamp;
+		uint8_t state;
+		uint8_t touched; // reached before: pos is set, counted against a node budget
+	};
 
-		fseek(fp, 0, SEEK_END);
-		size_t flen = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
+	NavGraphSearch() : generation(0) {}
 
-		uint8_t *data = new uint8_t[flen];
-		if (data == NULL)
+	// Grows to 'polyCount' nodes, never shrinks: one scratch serves every map.
+	void Reset(int polyCount)
+	{
+		if ((int)nodes.size() < polyCount || ++generation == 0)
 		{
-			printf("RecastNavigationHandle::create: open({%s}), memory(size={%d}) error!\n", resPath.c_str(), (int)flen);
-
-			fclose(fp);
-			SAFE_RELEASE_ARRAY(data);
-			return NULL;
+			Node init;
+			memset(&init, 0, sizeof(init));
+			nodes.assign(polyCount, init);
+			generation = 1;
 		}
+		open.clear();
+	}
 
-		size_t readsize = fread(data, 1, flen, fp);
-		if (readsize != flen)
+	inline Node &Get(uint32_t index)
+	{
+		Node &node = nodes[index];
+		if (node.stamp != generation)
 		{
-			printf("RecastNavigationHandle::create: open({%s}), read(size={%d} != {%d}) error!\n", resPath.c_str(), (int)readsize, (int)flen);
-
-			fclose(fp);
-			SAFE_RELEASE_ARRAY(data);
-			return NULL;
+			node.cost = FLT_MAX;
+			node.total = FLT_MAX;
+			node.parent = NavPolyIndex::INVALID;
+			node.stamp = generation;
+			node.state = 0;
+			node.touched = 0;
 		}
+		return node;
+	}
 
-		if (readsize < sizeof(NavMeshSetHeader))
+	inline void Push(uint32_t index, float total)
+	{
+		open.push_back(std::make_pair(total, index));
+		std::push_heap(open.begin(), open.end(), std::greater<std::pair<float, uint32_t>>());
+	}
+
+	// Pops the cheapest open node, skipping entries superseded by a later Push.
+	inline uint32_t Pop()
+	{
+		while (!open.empty())
 		{
-			printf("RecastNavigationHandle::create: open({%s}), NavMeshSetHeader is error!\n", resPath.c_str());
+			std::pop_heap(open.begin(), open.end(), std::greater<std::pair<float, uint32_t>>());
+			std::pair<float, uint32_t> top = open.back();
+			open.pop_back();
 
-			fclose(fp);
-			SAFE_RELEASE_ARRAY(data);
-			return NULL;
+			Node &node = nodes[top.second];
+			if (node.state == NODE_OPEN && node.total == top.first)
+			{
+				node.state = NODE_CLOSED;
+				return top.second;
+			}
 		}
+		return NavPolyIndex::INVALID;
+	}
 
-		NavMeshSetHeader header;
+	std::vector<Node> nodes;
+	std::vector<std::pair<float, uint32_t>> open;
+	uint32_t generation;
+};
+
+// FNV-1a over the tile layout, vertices, poly vertex indices, flags and areas.
+// Keys sidecar tables to the exact navmesh they were computed for; the flags
+// decide which polys the landmark and visibility builds walk on.
+static uint64_t NavMeshHash(const dtNavMesh *mesh)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	struct Fnv
+	{
+		static void Mix(uint64_t &h, const void *data, size_t size)
+		{
+			const unsigned char *p = (const unsigned char *)data;
+			for (size_t i = 0; i < size; i++)
+				h = (h ^ p[i]) * 1099511628211ULL;
+		}
+	};
+
+	for (int i = 0; i < mesh->getMaxTiles(); ++i)
+	{
+		const dtMeshTile *tile = mesh->getTile(i);
+		if (!tile || !tile->header)
+			continue;
+
+		const dtMeshHeader *header = tile->header;
+		int layout[5] = {header->x, header->y, header->layer, header->polyCount, header->vertCount};
+		Fnv::Mix(hash, layout, sizeof(layout));
+		Fnv::Mix(hash, tile->verts, sizeof(float) * 3 * header->vertCount);
+		for (int j = 0; j < header->polyCount; ++j)
+		{
+			const dtPoly &poly = tile->polys[j];
+			const unsigned short attrs[2] = {poly.flags, (unsigned short)poly.getArea()};
+			Fnv::Mix(hash, poly.verts, sizeof(unsigned short) * poly.vertCount);
+			Fnv::Mix(hash, attrs, sizeof(attrs));
+		}
+	}
+	return hash;
+}
+
+/**
+ * ALT (A*, landmarks, triangle inequality) tables. Distances are measured on the
+ * portal graph FindPolyPath walks: its nodes are the portal midpoints and every
+ * two portals of the same poly are joined by a straight leg. For K landmark
+ * polys we keep, per poly, the distance from the nearest of its portals to the
+ * landmark's portals, quantized to 16 bits. Portals of one poly are at most
+ * twice its radius apart, so |d(L, goal) - d(L, n)| less that spread is a lower
+ * bound of the remaining midpoint to midpoint cost.
+ */
+class NavLandmarks
+{
+public:
+	static const uint32_t FILE_MAGIC = 'N' << 24 | 'A' << 16 | 'L' << 8 | 'T';
+	static const uint32_t FILE_VERSION = 3;
+	static const uint16_t UNREACHABLE = 0xffff;
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t meshHash;
+		int32_t landmarkCount;
+		int32_t polyCount;
+		float step;
+	};
+
+	NavLandmarks() : count(0), polyCount(0), step(1.0f), meshHash(0) {}
+
+	void Build(const dtNavMesh *mesh, const NavPolyIndex &index, int landmarkCount)
+	{
+		polyCount = index.Count();
+		meshHash = NavMeshHash(mesh);
+
+		dtQueryFilter filter;
+		filter.setIncludeFlags(0xffff);
+		filter.setExcludeFlags(0);
+
+		std::vector<float> centers(polyCount * 3);
+		std::vector<float> radius(polyCount, 0.0f);
+		std::vector<bool> usable(polyCount, false);
+		for (int i = 0; i < polyCount; ++i)
+		{
+			const dtMeshTile *tile = NULL;
+			const dtPoly *poly = NULL;
+			mesh->getTileAndPolyByRefUnsafe(index.refs[i], &tile, &poly);
+			usable[i] = filter.passFilter(index.refs[i], tile, poly);
+
+			float *c = &centers[i * 3];
+			dtCalcPolyCenter(c, poly->verts, poly->vertCount, tile->verts);
+			for (int k = 0; k < poly->vertCount; ++k)
+				radius[i] = dtMax(radius[i], dtVdist(c, &tile->verts[poly->verts[k] * 3]));
+		}
+
+		// One portal per link, touching both of its polys. Legs are undirected,
+		// which never makes a distance longer, so one-way off-mesh links are fine.
+		std::vector<Portal> portals;
+		for (int i = 0; i < polyCount; ++i)
+		{
+			if (!usable[i])
+				continue;
+
+			const dtMeshTile *tile = NULL;
+			const dtPoly *poly = NULL;
+			mesh->getTileAndPolyByRefUnsafe(index.refs[i], &tile, &poly);
+			for (unsigned int k = poly->firstLink; k != DT_NULL_LINK; k = tile->links[k].next)
+			{
+				const dtPolyRef neighbourRef = tile->links[k].ref;
+				if (!neighbourRef)
+					continue;
+
+				const uint32_t n = index.Index(neighbourRef);
+				if (!usable[n])
+					continue;
+
+				const dtMeshTile *neighbourTile = NULL;
+				const dtPoly *neighbourPoly = NULL;
+				mesh->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
+
+				Portal portal;
+				NavPortalMidpoint(index.refs[i], tile, poly, tile->links[k], neighbourTile, neighbourPoly, portal.pos);
+				portal.poly[0] = (uint32_t)i;
+				portal.poly[1] = n;
+				portals.push_back(portal);
+
+				// off-mesh ends may sit slightly outside the poly they land on
+				radius[i] = dtMax(radius[i], dtVdist(&centers[i * 3], portal.pos));
+				radius[n] = dtMax(radius[n], dtVdist(&centers[n * 3], portal.pos));
+			}
+		}
+
+		// poly -> portals touching it (CSR)
+		std::vector<uint32_t> portalBase(polyCount + 1, 0);
+		std::vector<uint32_t> polyPortals(portals.size() * 2);
+		for (size_t p = 0; p < portals.size(); ++p)
+		{
+			portalBase[portals[p].poly[0] + 1]++;
+			portalBase[portals[p].poly[1] + 1]++;
+		}
+		for (int i = 0; i < polyCount; ++i)
+			portalBase[i + 1] += portalBase[i];
+		{
+			std::vector<uint32_t> fill(portalBase.begin(), portalBase.end() - 1);
+			for (size_t p = 0; p < portals.size(); ++p)
+			{
+				polyPortals[fill[portals[p].poly[0]]++] = (uint32_t)p;
+				polyPortals[fill[portals[p].poly[1]]++] = (uint32_t)p;
+			}
+		}
+
+		// farthest point selection: each new landmark is the poly furthest from
+		// all landmarks so far; polys no landmark reaches (other islands) win first
+		std::vector<std::vector<float>> dists;
+		std::vector<float> nearestLandmark(polyCount, FLT_MAX);
+		int next = -1;
+		for (int i = 0; i < polyCount && next < 0; ++i)
+			next = usable[i] ? i : -1;
+
+		while (next >= 0 && (int)dists.size() < landmarkCount)
+		{
+			landmarks.push_back(index.refs[next]);
+			dists.push_back(std::vector<float>());
+			dijkstra(portals, portalBase, polyPortals, (uint32_t)next, dists.back());
+
+			next = -1;
+			float farthest = 0;
+			for (int i = 0; i < polyCount; ++i)
+			{
+				if (!usable[i])
+					continue;
+				nearestLandmark[i] = dtMin(nearestLandmark[i], dists.back()[i]);
+				if (nearestLandmark[i] > farthest)
+				{
+					farthest = nearestLandmark[i];
+					next = i;
+				}
+			}
+		}
+
+		count = (int)dists.size();
+
+		float maxDist = 0;
+		for (int k = 0; k < count; ++k)
+			for (int i = 0; i < polyCount; ++i)
+				if (dists[k][i] < FLT_MAX)
+					maxDist = dtMax(maxDist, dists[k][i]);
+		for (int i = 0; i < polyCount; ++i)
+			maxDist = dtMax(maxDist, radius[i]);
+		step = dtMax(maxDist / (UNREACHABLE - 1), 0.001f);
+
+		table.assign((size_t)polyCount * count, UNREACHABLE);
+		for (int i = 0; i < polyCount; ++i)
+			for (int k = 0; k < count; ++k)
+				if (dists[k][i] < FLT_MAX)
+					table[(size_t)i * count + k] = (uint16_t)(dists[k][i] / step);
+
+		radii.resize(polyCount);
+		for (int i = 0; i < polyCount; ++i)
+			radii[i] = (uint16_t)dtMin(ceilf(radius[i] / step), (float)(UNREACHABLE - 1));
+	}
+
+	bool Load(const char *path, const dtNavMesh *mesh, const NavPolyIndex &index, int landmarkCount)
+	{
+		FILE *fp = fopen(path, "rb");
+		if (!fp)
+			return false;
+
+		FileHeader header;
+		bool ok = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == FILE_MAGIC && header.version == FILE_VERSION &&
+				  header.landmarkCount == landmarkCount && header.polyCount == index.Count() && header.meshHash == NavMeshHash(mesh);
+		if (ok)
+		{
+			count = header.landmarkCount;
+			polyCount = header.polyCount;
+			step = header.step;
+			meshHash = header.meshHash;
+
+			std::vector<uint32_t> landmarkIdx(count);
+			table.resize((size_t)polyCount * count);
+			radii.resize(polyCount);
+			ok = fread(landmarkIdx.data(), sizeof(uint32_t), count, fp) == (size_t)count &&
+				 fread(table.data(), sizeof(uint16_t), table.size(), fp) == table.size() &&
+				 fread(radii.data(), sizeof(uint16_t), radii.size(), fp) == radii.size();
+
+			landmarks.clear();
+			for (int k = 0; ok && k < count; ++k)
+				landmarks.push_back(index.refs[landmarkIdx[k] % polyCount]);
+		}
+
+		fclose(fp);
+		return ok;
+	}
+
+	bool Save(const char *path, const NavPolyIndex &index) const
+	{
+		FILE *fp = fopen(path, "wb");
+		if (!fp)
+		{
+			printf("NavLandmarks::Save: open({%s}) is error!\n", path);
+			return false;
+		}
+
+		FileHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = FILE_MAGIC;
+		header.version = FILE_VERSION;
+		header.meshHash = meshHash;
+		header.landmarkCount = count;
+		header.polyCount = polyCount;
+		header.step = step;
+
+		std::vector<uint32_t> landmarkIdx;
+		for (int k = 0; k < count; ++k)
+			landmarkIdx.push_back(index.Index(landmarks[k]));
+
+		fwrite(&header, sizeof(header), 1, fp);
+		fwrite(landmarkIdx.data(), sizeof(uint32_t), landmarkIdx.size(), fp);
+		fwrite(table.data(), sizeof(uint16_t), table.size(), fp);
+		fwrite(radii.data(), sizeof(uint16_t), radii.size(), fp);
+		fclose(fp);
+		return true;
+	}
+
+	// Lower bound of the path cost from poly 'n' to poly 'goal', 0 if unknown.
+	inline float Heuristic(uint32_t n, uint32_t goal) const
+	{
+		const uint16_t *dn = &table[(size_t)n * count];
+		const uint16_t *dg = &table[(size_t)goal * count];
+
+		int best = 0;
+		for (int k = 0; k < count; ++k)
+		{
+			if (dn[k] == UNREACHABLE || dg[k] == UNREACHABLE)
+				continue;
+			best = dtMax(best, dtAbs((int)dn[k] - (int)dg[k]));
+		}
+
+		// the actual portals of 'n' and 'goal' may each sit up to twice the
+		// radius further out, plus one step of quantization error per table read
+		best -= 2 * dtMax(radii[n], radii[goal]) + 2;
+		return best > 0 ? best * step : 0.0f;
+	}
+
+	size_t GetMemorySize() const
+	{
+		return table.size() * sizeof(uint16_t) + radii.size() * sizeof(uint16_t);
+	}
+
+	int count;
+	int polyCount;
+	float step;
+	uint64_t meshHash;
+	std::vector<dtPolyRef> landmarks;
+	std::vector<uint16_t> table; // polyCount x count, one row per poly
+	std::vector<uint16_t> radii;
+
+private:
+	typedef std::pair<float, uint32_t> Edge;
+
+	struct Portal
+	{
+		float pos[3];
+		uint32_t poly[2];
+	};
+
+	// Multi-source Dijkstra over portals, seeded with every portal of 'source';
+	// 'dist' gets the distance of each poly's nearest portal.
+	static void dijkstra(const std::vector<Portal> &portals, const std::vector<uint32_t> &portalBase,
+						 const std::vector<uint32_t> &polyPortals, uint32_t source, std::vector<float> &dist)
+	{
+		std::vector<float> portalDist(portals.size(), FLT_MAX);
+		std::vector<Edge> open;
+		for (uint32_t i = portalBase[source]; i < portalBase[source + 1]; ++i)
+		{
+			portalDist[polyPortals[i]] = 0;
+			open.push_back(Edge(0.0f, polyPortals[i]));
+		}
+
+		while (!open.empty())
+		{
+			std::pop_heap(open.begin(), open.end(), std::greater<Edge>());
+			Edge top = open.back();
+			open.pop_back();
+			if (top.first > portalDist[top.second])
+				continue;
+
+			const Portal &from = portals[top.second];
+			for (int side = 0; side < 2; ++side)
+			{
+				const uint32_t poly = from.poly[side];
+				for (uint32_t i = portalBase[poly]; i < portalBase[poly + 1]; ++i)
+				{
+					const uint32_t n = polyPortals[i];
+					const float d = top.first + dtVdist(from.pos, portals[n].pos);
+					if (d < portalDist[n])
+					{
+						portalDist[n] = d;
+						open.push_back(Edge(d, n));
+						std::push_heap(open.begin(), open.end(), std::greater<Edge>());
+					}
+				}
+			}
+		}
+
+		dist.assign(portalBase.size() - 1, FLT_MAX);
+		dist[source] = 0;
+		for (size_t p = 0; p < portals.size(); ++p)
+			for (int side = 0; side < 2; ++side)
+				dist[portals[p].poly[side]] = dtMin(dist[portals[p].poly[side]], portalDist[p]);
+	}
+};
+
+/**
+ * Approximately blocked pairs of XZ grid cells, for HasLineOfSight. For every
+ * ordered pair of cells within 'range' a few rays are cast between sample
+ * points of both cells; the pair is marked blocked when none gets through.
+ * Every other pair, cells with more than one layer or holes under a sample
+ * stay unknown. The samples are not exhaustive: a ray between two other
+ * points of a blocked pair (past the end of a wall, through a doorway
+ * narrower than the sample spacing) may well get through, so blocked is a
+ * hint, not a proof, and only approximate queries may answer from it. Rows only
+ * cover the (2w+1)^2 window around a cell, w = ceil(range / cellSize), so the
+ * table grows with the map area.
+ *
+ * Building is slow (25 rays per pair), Start() runs it on a background thread
+ * with its own query and Lookup() answers unknown until it is done.
+ */
+class NavVisibility
+{
+public:
+	static const uint32_t FILE_MAGIC = 'N' << 24 | 'P' << 16 | 'V' << 8 | 'S';
+	static const uint32_t FILE_VERSION = 3;
+	static const int SAMPLES = 5;
+	static const int MAX_CELLS = 1024 * 1024;
+
+	enum
+	{
+		VIS_UNKNOWN = 0,
+		VIS_BLOCKED = 2,
+	};
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t meshHash;
+		float orig[2];
+		float cellSize;
+		int32_t width;
+		int32_t height;
+		int32_t window;
+	};
+
+	NavVisibility() : cellSize(0), invCellSize(0), width(0), height(0), window(0), rowBits(0), meshHash(0), ready(false), cancel(false)
+	{
+		orig[0] = orig[1] = 0;
+	}
+
+	~NavVisibility()
+	{
+		Stop();
+	}
+
+	bool Init(const dtNavMesh *mesh, const float *bmin, const float *bmax, float cs, float range)
+	{
+		cellSize = cs;
+		invCellSize = 1.0f / cs;
+		orig[0] = bmin[0];
+		orig[1] = bmin[2];
+		width = (int)ceilf((bmax[0] - bmin[0]) * invCellSize);
+		height = (int)ceilf((bmax[2] - bmin[2]) * invCellSize);
+		window = (int)ceilf(range * invCellSize);
+		rowBits = (2 * window + 1) * (2 * window + 1);
+		meshHash = NavMeshHash(mesh);
+
+		if ((int64_t)width * height > MAX_CELLS)
+		{
+			printf("NavVisibility::Init: cell size({%f}) is too small, {%d}x{%d} cells!\n", cs, width, height);
+			return false;
+		}
+		return width > 0 && height > 0;
+	}
+
+	// Loads the tables or builds them in the background, saving them to
+	// 'path' (if any) once built.
+	void Start(const dtNavMesh *mesh, const std::string &path)
+	{
+		if (!path.empty() && Load(path.c_str()))
+		{
+			ready.store(true, std::memory_order_release);
+			return;
+		}
+
+		cancel.store(false);
+		worker = std::thread([this, mesh, path]() {
+			if (!Build(mesh))
+				return;
+
+			ready.store(true, std::memory_order_release);
+			printf("\t==> PVS {%d}x{%d} cells ready ({%.2f} MB)\n", width, height, ((float)GetMemorySize() / 1048576));
+			if (!path.empty())
+				Save(path.c_str());
+		});
+	}
+
+	void Stop()
+	{
+		cancel.store(true);
+		if (worker.joinable())
+			worker.join();
+	}
+
+	bool IsReady() const
+	{
+		return ready.load(std::memory_order_acquire);
+	}
+
+	// VIS_* for a ray from 'a' to 'b', read from the cells both points fall in.
+	// VIS_BLOCKED means the sampled rays between the cells were all blocked.
+	inline int Lookup(const float *a, const float *b) const
+	{
+		if (!IsReady())
+			return VIS_UNKNOWN;
+
+		const int ax = (int)floorf((a[0] - orig[0]) * invCellSize);
+		const int az = (int)floorf((a[2] - orig[1]) * invCellSize);
+		const int bx = (int)floorf((b[0] - orig[0]) * invCellSize);
+		const int bz = (int)floorf((b[2] - orig[1]) * invCellSize);
+		if (ax < 0 || az < 0 || ax >= width || az >= height || dtAbs(bx - ax) > window || dtAbs(bz - az) > window)
+			return VIS_UNKNOWN;
+
+		const size_t bit = pairBit(az * width + ax, bx - ax, bz - az);
+		if (blocked[bit >> 6] >> (bit & 63) & 1)
+			return VIS_BLOCKED;
+		return VIS_UNKNOWN;
+	}
+
+	size_t GetMemorySize() const
+	{
+		return blocked.size() * sizeof(uint64_t);
+	}
+
+	float orig[2];
+	float cellSize;
+	float invCellSize;
+	int width;
+	int height;
+	int window;
+	int rowBits;
+	uint64_t meshHash;
+	std::vector<uint64_t> blocked; // width * height rows of rowBits
+
+private:
+	struct Sample
+	{
+		dtPolyRef ref;
+		float pos[3];
+	};
+
+	inline size_t pairBit(int cell, int dx, int dz) const
+	{
+		return (size_t)cell * rowBits + (size_t)((dz + window) * (2 * window + 1) + dx + window);
+	}
+
+	// Samples the cell centre and four inset points. False when any of them
+	// has no ground or more than one layer.
+	bool sampleCell(const dtNavMesh *mesh, dtNavMeshQuery *query, const dtQueryFilter &filter, int x, int z, float halfY, float midY, Sample *samples) const
+	{
+		static const float offsets[SAMPLES][2] = {{0.5f, 0.5f}, {0.25f, 0.25f}, {0.75f, 0.25f}, {0.25f, 0.75f}, {0.75f, 0.75f}};
+
+		for (int s = 0; s < SAMPLES; ++s)
+		{
+			float pt[3] = {orig[0] + (x + offsets[s][0]) * cellSize, midY, orig[1] + (z + offsets[s][1]) * cellSize};
+			const float extents[3] = {0.01f, halfY, 0.01f};
+
+			dtPolyRef polys[8];
+			int npolys = 0;
+			query->queryPolygons(pt, extents, &filter, polys, &npolys, 8);
+
+			int layers = 0;
+			for (int i = 0; i < npolys; ++i)
+			{
+				const dtMeshTile *tile = NULL;
+				const dtPoly *poly = NULL;
+				mesh->getTileAndPolyByRefUnsafe(polys[i], &tile, &poly);
+				if (poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+					continue;
+
+				float verts[DT_VERTS_PER_POLYGON * 3];
+				for (int k = 0; k < poly->vertCount; ++k)
+					dtVcopy(&verts[k * 3], &tile->verts[poly->verts[k] * 3]);
+				if (!dtPointInPolygon(pt, verts, poly->vertCount))
+					continue;
+
+				float h = 0;
+				if (dtStatusFailed(query->getPolyHeight(polys[i], pt, &h)))
+					continue;
+
+				samples[s].ref = polys[i];
+				dtVset(samples[s].pos, pt[0], h, pt[2]);
+				layers++;
+			}
+
+			if (layers != 1)
+				return false;
+		}
+		return true;
+	}
+
+	bool Build(const dtNavMesh *mesh)
+	{
+		dtNavMeshQuery *query = dtAllocNavMeshQuery();
+		if (!query || dtStatusFailed(query->init(mesh, 64)))
+		{
+			dtFreeNavMeshQuery(query);
+			return false;
+		}
+
+		dtQueryFilter filter;
+		filter.setIncludeFlags(0xffff);
+		filter.setExcludeFlags(0);
+
+		float ymin = FLT_MAX, ymax = -FLT_MAX;
+		for (int i = 0; i < mesh->getMaxTiles(); ++i)
+		{
+			const dtMeshTile *tile = mesh->getTile(i);
+			if (!tile || !tile->header)
+				continue;
+			ymin = dtMin(ymin, tile->header->bmin[1]);
+			ymax = dtMax(ymax, tile->header->bmax[1]);
+		}
+		const float halfY = (ymax - ymin) * 0.5f + 1.0f;
+		const float midY = (ymin + ymax) * 0.5f;
+
+		const int cells = width * height;
+		std::vector<Sample> samples((size_t)cells * SAMPLES);
+		std::vector<bool> usable(cells);
+		for (int z = 0; z < height; ++z)
+			for (int x = 0; x < width; ++x)
+				usable[z * width + x] = sampleCell(mesh, query, filter, x, z, halfY, midY, &samples[(size_t)(z * width + x) * SAMPLES]);
+
+		const size_t words = ((size_t)cells * rowBits + 63) / 64;
+		std::vector<uint64_t> blk(words, 0);
+
+		dtPolyRef path[RAY_PATH];
+		for (int a = 0; a < cells; ++a)
+		{
+			if (cancel.load(std::memory_order_relaxed))
+			{
+				dtFreeNavMeshQuery(query);
+				return false;
+			}
+			if (!usable[a])
+				continue;
+
+			const int ax = a % width;
+			const int az = a / width;
+			for (int dz = -window; dz <= window; ++dz)
+			{
+				for (int dx = -window; dx <= window; ++dx)
+				{
+					const int bx = ax + dx;
+					const int bz = az + dz;
+					if (bx < 0 || bz < 0 || bx >= width || bz >= height || !usable[bz * width + bx])
+						continue;
+
+					// stop at the first ray that gets through
+					int hits = 0;
+					int rays = 0;
+					const Sample *sa = &samples[(size_t)a * SAMPLES];
+					const Sample *sb = &samples[(size_t)(bz * width + bx) * SAMPLES];
+					for (int i = 0; i < SAMPLES && hits == rays; ++i)
+					{
+						for (int j = 0; j < SAMPLES && hits == rays; ++j)
+						{
+							float t = 0;
+							float normal[3];
+							int npath = 0;
+							query->raycast(sa[i].ref, sa[i].pos, sb[j].pos, &filter, &t, normal, path, &npath, RAY_PATH);
+							hits += t <= 1.0f ? 1 : 0;
+							rays++;
+						}
+					}
+
+					if (hits != SAMPLES * SAMPLES)
+						continue;
+
+					const size_t bit = pairBit(a, dx, dz);
+					blk[bit >> 6] |= 1ULL << (bit & 63);
+				}
+			}
+		}
+
+		dtFreeNavMeshQuery(query);
+		blocked.swap(blk);
+		return true;
+	}
+
+	bool Load(const char *path)
+	{
+		FILE *fp = fopen(path, "rb");
+		if (!fp)
+			return false;
+
+		FileHeader header;
+		bool ok = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == FILE_MAGIC && header.version == FILE_VERSION &&
+				  header.meshHash == meshHash && header.orig[0] == orig[0] && header.orig[1] == orig[1] && header.cellSize == cellSize &&
+				  header.width == width && header.height == height && header.window == window;
+		if (ok)
+		{
+			const size_t words = ((size_t)width * height * rowBits + 63) / 64;
+			blocked.resize(words);
+			ok = fread(blocked.data(), sizeof(uint64_t), words, fp) == words;
+		}
+
+		fclose(fp);
+		return ok;
+	}
+
+	bool Save(const char *path) const
+	{
+		FILE *fp = fopen(path, "wb");
+		if (!fp)
+		{
+			printf("NavVisibility::Save: open({%s}) is error!\n", path);
+			return false;
+		}
+
+		FileHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = FILE_MAGIC;
+		header.version = FILE_VERSION;
+		header.meshHash = meshHash;
+		header.orig[0] = orig[0];
+		header.orig[1] = orig[1];
+		header.cellSize = cellSize;
+		header.width = width;
+		header.height = height;
+		header.window = window;
+
+		fwrite(&header, sizeof(header), 1, fp);
+		fwrite(blocked.data(), sizeof(uint64_t), blocked.size(), fp);
+		fclose(fp);
+		return true;
+	}
+
+	static const int RAY_PATH = 256;
+
+	std::atomic<bool> ready;
+	std::atomic<bool> cancel;
+	std::thread worker;
+};
+
+/**
+ * Section offsets of a tile blob as laid out by dtCreateNavMeshData and
+ * expected by dtNavMesh::addTile.
+ */
+struct NavTileLayout
+{
+	int verts;
+	int polys;
+	int links;
+	int detailMeshes;
+	int detailVerts;
+	int detailTris;
+	int bvTree;
+	int offMeshCons;
+	int size;
+
+	// Returns false when 'data' is not a tile blob of at least the laid out size.
+	bool Init(const unsigned char *data, int dataSize)
+	{
+		if (dataSize < (int)sizeof(dtMeshHeader))
+			return false;
+
+		const dtMeshHeader *header = (const dtMeshHeader *)data;
+		if (header->magic != DT_NAVMESH_MAGIC || header->version != DT_NAVMESH_VERSION)
+			return false;
+
+		Compute(header);
+		return size <= dataSize;
+	}
+
+	void Compute(const dtMeshHeader *header)
+	{
+		verts = dtAlign4(sizeof(dtMeshHeader));
+		polys = verts + dtAlign4(sizeof(float) * 3 * header->vertCount);
+		links = polys + dtAlign4(sizeof(dtPoly) * header->polyCount);
+		detailMeshes = links + dtAlign4(sizeof(dtLink) * header->maxLinkCount);
+		detailVerts = detailMeshes + dtAlign4(sizeof(dtPolyDetail) * header->detailMeshCount);
+		detailTris = detailVerts + dtAlign4(sizeof(float) * 3 * header->detailVertCount);
+		bvTree = detailTris + dtAlign4(sizeof(unsigned char) * 4 * header->detailTriCount);
+		offMeshCons = bvTree + dtAlign4(sizeof(dtBVNode) * header->bvNodeCount);
+		size = offMeshCons + dtAlign4(sizeof(dtOffMeshConnection) * header->offMeshConCount);
+	}
+};
+
+/**
+ * Load time reordering of a tile blob along a Morton (Z-order) curve, applied
+ * before addTile. Ground polys are sorted by the key of their centroid in the
+ * tile's XZ bounds, so polys that are close in space are close in memory;
+ * vertices and detail meshes follow the polys in order of first use. addTile
+ * builds the links in poly order, so they come out in the same order.
+ * Off-mesh connection polys stay at the end where dtOffMeshConnection::poly
+ * expects them.
+ */
+class NavTileReorder
+{
+public:
+	// Reorders 'data' in place. Returns false and leaves it untouched when the
+	// blob does not have the layout this pass understands.
+	static bool Apply(unsigned char *data, int dataSize)
+	{
+		NavTileLayout layout;
+		if (!layout.Init(data, dataSize))
+			return false;
+
+		dtMeshHeader *header = (dtMeshHeader *)data;
+		const int groundCount = header->offMeshBase;
+		if (groundCount <= 1 || groundCount > header->polyCount || header->detailMeshCount != groundCount)
+			return false;
+
+		float *verts = (float *)(data + layout.verts);
+		dtPoly *polys = (dtPoly *)(data + layout.polys);
+		dtPolyDetail *detailMeshes = (dtPolyDetail *)(data + layout.detailMeshes);
+		float *detailVerts = (float *)(data + layout.detailVerts);
+		unsigned char *detailTris = data + layout.detailTris;
+		dtBVNode *bvTree = (dtBVNode *)(data + layout.bvTree);
+
+		// new poly order
+		const float sx = header->bmax[0] > header->bmin[0] ? 65535.0f / (header->bmax[0] - header->bmin[0]) : 0.0f;
+		const float sz = header->bmax[2] > header->bmin[2] ? 65535.0f / (header->bmax[2] - header->bmin[2]) : 0.0f;
+
+		std::vector<std::pair<uint32_t, int>> keys(groundCount);
+		for (int i = 0; i < groundCount; ++i)
+		{
+			const dtPoly &poly = polys[i];
+			float c[3] = {0.0f, 0.0f, 0.0f};
+			for (int j = 0; j < poly.vertCount; ++j)
+				dtVadd(c, c, &verts[poly.verts[j] * 3]);
+			if (poly.vertCount)
+				dtVscale(c, c, 1.0f / poly.vertCount);
+
+			const uint32_t qx = (uint32_t)dtClamp((c[0] - header->bmin[0]) * sx, 0.0f, 65535.0f);
+			const uint32_t qz = (uint32_t)dtClamp((c[2] - header->bmin[2]) * sz, 0.0f, 65535.0f);
+			keys[i] = std::make_pair(Part1By1(qx) | Part1By1(qz) << 1, i);
+		}
+		std::sort(keys.begin(), keys.end());
+
+		std::vector<int> order(header->polyCount);
+		std::vector<unsigned short> polyRemap(header->polyCount);
+		for (int i = 0; i < header->polyCount; ++i)
+			order[i] = i < groundCount ? keys[i].second : i;
+		for (int i = 0; i < header->polyCount; ++i)
+			polyRemap[order[i]] = (unsigned short)i;
+
+		// vertices by first use in the new poly order, unused ones last
+		std::vector<int> vertRemap(header->vertCount, -1);
+		int nverts = 0;
+		for (int i = 0; i < header->polyCount; ++i)
+		{
+			const dtPoly &poly = polys[order[i]];
+			for (int j = 0; j < poly.vertCount; ++j)
+			{
+				if (poly.verts[j] >= header->vertCount || (poly.neis[j] && !(poly.neis[j] & DT_EXT_LINK) && poly.neis[j] > header->polyCount))
+					return false;
+				if (vertRemap[poly.verts[j]] < 0)
+					vertRemap[poly.verts[j]] = nverts++;
+			}
+		}
+		for (int i = 0; i < header->vertCount; ++i)
+		{
+			if (vertRemap[i] < 0)
+				vertRemap[i] = nverts++;
+		}
+
+		std::vector<float> oldVerts(verts, verts + header->vertCount * 3);
+		for (int i = 0; i < header->vertCount; ++i)
+			dtVcopy(&verts[vertRemap[i] * 3], &oldVerts[i * 3]);
+
+		// polys: internal neighbours are 1-based poly indices, external ones
+		// (DT_EXT_LINK) carry a side and are resolved by addTile
+		std::vector<dtPoly> oldPolys(polys, polys + header->polyCount);
+		for (int i = 0; i < header->polyCount; ++i)
+		{
+			dtPoly &poly = polys[i];
+			poly = oldPolys[order[i]];
+			poly.firstLink = DT_NULL_LINK;
+			for (int j = 0; j < poly.vertCount; ++j)
+			{
+				poly.verts[j] = (unsigned short)vertRemap[poly.verts[j]];
+				if (poly.neis[j] && !(poly.neis[j] & DT_EXT_LINK))
+					poly.neis[j] = (unsigned short)(polyRemap[poly.neis[j] - 1] + 1);
+			}
+		}
+
+		// detail meshes follow their polys, their vertices and triangles are
+		// repacked in the same order
+		std::vector<dtPolyDetail> oldDetail(detailMeshes, detailMeshes + groundCount);
+		std::vector<float> oldDetailVerts(detailVerts, detailVerts + header->detailVertCount * 3);
+		std::vector<unsigned char> oldDetailTris(detailTris, detailTris + header->detailTriCount * 4);
+		unsigned int vbase = 0;
+		unsigned int tbase = 0;
+		for (int i = 0; i < groundCount; ++i)
+		{
+			dtPolyDetail pd = oldDetail[order[i]];
+			if (pd.vertBase + pd.vertCount > (unsigned int)header->detailVertCount || pd.triBase + pd.triCount > (unsigned int)header->detailTriCount)
+			{
+				// corrupt detail mesh, put everything back
+				memcpy(verts, oldVerts.data(), oldVerts.size() * sizeof(float));
+				memcpy(polys, oldPolys.data(), oldPolys.size() * sizeof(dtPoly));
+				memcpy(detailMeshes, oldDetail.data(), oldDetail.size() * sizeof(dtPolyDetail));
+				memcpy(detailVerts, oldDetailVerts.data(), oldDetailVerts.size() * sizeof(float));
+				memcpy(detailTris, oldDetailTris.data(), oldDetailTris.size());
+				return false;
+			}
+
+			memcpy(&detailVerts[vbase * 3], &oldDetailVerts[pd.vertBase * 3], sizeof(float) * 3 * pd.vertCount);
+			memcpy(&detailTris[tbase * 4], &oldDetailTris[pd.triBase * 4], 4 * pd.triCount);
+			pd.vertBase = vbase;
+			pd.triBase = tbase;
+			vbase += pd.vertCount;
+			tbase += pd.triCount;
+			detailMeshes[i] = pd;
+		}
+
+		// the BV tree keeps its shape, leaves point at the moved polys
+		for (int i = 0; i < header->bvNodeCount; ++i)
+		{
+			if (bvTree[i].i >= 0 && bvTree[i].i < header->polyCount)
+				bvTree[i].i = polyRemap[bvTree[i].i];
+		}
+
+		return true;
+	}
+
+private:
+	// spreads the low 16 bits of 'x' to the even bits
+	static uint32_t Part1By1(uint32_t x)
+	{
+		x &= 0x0000ffff;
+		x = (x ^ (x << 8)) & 0x00ff00ff;
+		x = (x ^ (x << 4)) & 0x0f0f0f0f;
+		x = (x ^ (x << 2)) & 0x33333333;
+		x = (x ^ (x << 1)) & 0x55555555;
+		return x;
+	}
+};
+
+/**
+ * Load time slimming of a tile blob for servers, which never render the
+ * detail meshes. A poly whose detail mesh stays within 'heightError' of the
+ * plain fan over its own vertices gets that fan instead (no detail vertices,
+ * vertCount - 2 triangles), so getPolyHeight keeps working with a bounded
+ * error. Tiles with at most 'bvPolys' polys lose their BV tree; Detour then
+ * scans their polys linearly. Vertices, links and off-mesh connections are
+ * read by the queries as they are and are kept.
+ */
+class NavTileStrip
+{
+public:
+	// DT_DETAIL_EDGE_BOUNDARY, not defined by older Detour versions
+	static const unsigned char EDGE_BOUNDARY = 0x01;
+
+	// Writes a smaller copy of 'data' (dtAlloc'ed) to 'out'. Returns false
+	// when the blob is not understood or nothing can be dropped.
+	static bool Apply(const unsigned char *data, int dataSize, float heightError, int bvPolys, unsigned char **out, int *outSize)
+	{
+		NavTileLayout layout;
+		if (!layout.Init(data, dataSize))
+			return false;
+
+		const dtMeshHeader *header = (const dtMeshHeader *)data;
+		const float *verts = (const float *)(data + layout.verts);
+		const dtPoly *polys = (const dtPoly *)(data + layout.polys);
+		const dtPolyDetail *detailMeshes = (const dtPolyDetail *)(data + layout.detailMeshes);
+		const float *detailVerts = (const float *)(data + layout.detailVerts);
+		const unsigned char *detailTris = data + layout.detailTris;
+
+		std::vector<dtPolyDetail> newMeshes(detailMeshes, detailMeshes + header->detailMeshCount);
+		std::vector<float> newVerts;
+		std::vector<unsigned char> newTris;
+
+		const bool simplify = heightError >= 0 && header->detailMeshCount <= header->polyCount;
+		for (int i = 0; i < header->detailMeshCount; ++i)
+		{
+			const dtPoly &poly = polys[i];
+			const dtPolyDetail &pd = detailMeshes[i];
+			if (pd.vertBase + pd.vertCount > (unsigned int)header->detailVertCount || pd.triBase + pd.triCount > (unsigned int)header->detailTriCount)
+				return false;
+
+			dtPolyDetail &nd = newMeshes[i];
+			nd.vertBase = (unsigned int)newVerts.size() / 3;
+			nd.triBase = (unsigned int)newTris.size() / 4;
+
+			if (simplify && poly.vertCount >= 3 && fanError(verts, poly, &detailVerts[pd.vertBase * 3], pd.vertCount) <= heightError)
+			{
+				const int nv = poly.vertCount;
+				for (int k = 1; k < nv - 1; ++k)
+				{
+					const unsigned char flags = (k == 1 ? EDGE_BOUNDARY : 0) | EDGE_BOUNDARY << 2 | (k == nv - 2 ? EDGE_BOUNDARY : 0) << 4;
+					const unsigned char tri[4] = {0, (unsigned char)k, (unsigned char)(k + 1), flags};
+					newTris.insert(newTris.end(), tri, tri + 4);
+				}
+				nd.vertCount = 0;
+				nd.triCount = (unsigned char)(nv - 2);
+			}
+			else
+			{
+				newVerts.insert(newVerts.end(), &detailVerts[pd.vertBase * 3], &detailVerts[(pd.vertBase + pd.vertCount) * 3]);
+				newTris.insert(newTris.end(), &detailTris[pd.triBase * 4], &detailTris[(pd.triBase + pd.triCount) * 4]);
+			}
+		}
+
+		dtMeshHeader newHeader = *header;
+		newHeader.detailVertCount = (int)newVerts.size() / 3;
+		newHeader.detailTriCount = (int)newTris.size() / 4;
+		if (header->polyCount <= bvPolys)
+			newHeader.bvNodeCount = 0;
+
+		NavTileLayout newLayout;
+		newLayout.Compute(&newHeader);
+		if (newLayout.size >= layout.size)
+			return false;
+
+		unsigned char *newData = (unsigned char *)dtAlloc(newLayout.size, DT_ALLOC_PERM);
+		if (!newData)
+			return false;
+		memset(newData, 0, newLayout.size);
+
+		memcpy(newData, &newHeader, sizeof(newHeader));
+		memcpy(newData + newLayout.verts, data + layout.verts, layout.detailMeshes - layout.verts); // verts, polys, links
+		memcpy(newData + newLayout.detailMeshes, newMeshes.data(), newMeshes.size() * sizeof(dtPolyDetail));
+		memcpy(newData + newLayout.detailVerts, newVerts.data(), newVerts.size() * sizeof(float));
+		memcpy(newData + newLayout.detailTris, newTris.data(), newTris.size());
+		memcpy(newData + newLayout.bvTree, data + layout.bvTree, newHeader.bvNodeCount * sizeof(dtBVNode));
+		memcpy(newData + newLayout.offMeshCons, data + layout.offMeshCons, header->offMeshConCount * sizeof(dtOffMeshConnection));
+
+		*out = newData;
+		*outSize = newLayout.size;
+		return true;
+	}
+
+private:
+	// Largest vertical distance of the detail vertices from the fan over the
+	// poly vertices, FLT_MAX when one of them falls outside the fan.
+	static float fanError(const float *verts, const dtPoly &poly, const float *detailVerts, int ndetail)
+	{
+		float error = 0;
+		for (int k = 0; k < ndetail; ++k)
+		{
+			const float *p = &detailVerts[k * 3];
+			bool inside = false;
+			for (int j = 1; j < poly.vertCount - 1 && !inside; ++j)
+			{
+				float h;
+				inside = dtClosestHeightPointTriangle(p, &verts[poly.verts[0] * 3], &verts[poly.verts[j] * 3], &verts[poly.verts[j + 1] * 3], h);
+				if (inside)
+					error = dtMax(error, dtAbs(h - p[1]));
+			}
+			if (!inside)
+				return FLT_MAX;
+		}
+		return error;
+	}
+};
+
+/**
+ * A loaded navmesh and the tables derived from its tile set. Read-only once
+ * built, so a base handle and every instance forked from it share one copy.
+ * Tile changes only happen until the mesh is first shared ('frozen'); they drop
+ * the slow tables and mark them stale, the handle rebuilds them on first use.
+ */
+struct NavmeshShared
+{
+	enum
+	{
+		STALE_LANDMARKS = 1,
+		STALE_HEIGHT_GRID = 2,
+		STALE_VISIBILITY = 4,
+	};
+
+	NavmeshShared() : pNavmesh(NULL), pHeightGrid(NULL), pLandmarks(NULL), pVisibility(NULL), stale(0), frozen(false) {}
+
+	~NavmeshShared()
+	{
+		// stops the build thread before the mesh goes away
+		SAFE_RELEASE(pVisibility);
+		SAFE_RELEASE(pHeightGrid);
+		SAFE_RELEASE(pLandmarks);
+		dtFreeNavMesh(pNavmesh);
+	}
+
+	dtNavMesh *pNavmesh;
+	float bmin[3];
+	float bmax[3];
+	NavPolyIndex polyIndex;
+	NavComponents components;
+	NavHeightGrid *pHeightGrid;
+	NavLandmarks *pLandmarks;
+	NavVisibility *pVisibility;
+	int stale;	 // STALE_* tables to rebuild before use
+	bool frozen; // forked or registered for instances, tiles never change again
+};
+
+/**
+ * Per instance poly flags on top of a shared navmesh. Tile data cannot be
+ * shared between dtNavMesh objects (addTile writes the links into it), so an
+ * instance shares the whole base mesh and copies the flags of a tile the first
+ * time it modifies that tile; all other tiles read the base flags.
+ *
+ * An instance can only clear flags: connected components and landmark tables
+ * are computed once for the base mesh and stay valid lower bounds only as long
+ * as instances never make a poly walkable that the base is not.
+ */
+class NavFlagOverlay
+{
+public:
+	NavFlagOverlay() : mesh(NULL), tiles(NULL) {}
+
+	void Init(const dtNavMesh *navmesh)
+	{
+		mesh = navmesh;
+		tiles = mesh->getTile(0);
+		Reset();
+	}
+
+	void Reset()
+	{
+		tileFlags.clear();
+		storage.clear();
+	}
+
+	bool IsModified() const
+	{
+		return !storage.empty();
+	}
+
+	inline unsigned short GetFlags(const dtMeshTile *tile, const dtPoly *poly) const
+	{
+		if (!tileFlags.empty())
+		{
+			const unsigned short *flags = tileFlags[tile - tiles];
+			if (flags)
+				return flags[poly - tile->polys];
+		}
+		return poly->flags;
+	}
+
+	bool SetFlags(dtPolyRef ref, unsigned short flags)
+	{
+		const dtMeshTile *tile = NULL;
+		const dtPoly *poly = NULL;
+		if (dtStatusFailed(mesh->getTileAndPolyByRef(ref, &tile, &poly)))
+			return false;
+
+		if (tileFlags.empty())
+			tileFlags.assign(mesh->getMaxTiles(), (unsigned short *)NULL);
+
+		const int it = (int)(tile - tiles);
+		if (!tileFlags[it])
+		{
+			std::vector<unsigned short> &copy = storage[it];
+			copy.resize(tile->header->polyCount);
+			for (int i = 0; i < tile->header->polyCount; ++i)
+				copy[i] = tile->polys[i].flags;
+			tileFlags[it] = copy.data();
+		}
+
+		tileFlags[it][poly - tile->polys] = flags & poly->flags;
+		return true;
+	}
+
+	size_t GetMemorySize() const
+	{
+		size_t size = tileFlags.size() * sizeof(unsigned short *);
+		for (std::map<int, std::vector<unsigned short>>::const_iterator it = storage.begin(); it != storage.end(); ++it)
+			size += it->second.size() * sizeof(unsigned short);
+		return size;
+	}
+
+	const dtNavMesh *mesh;
+	const dtMeshTile *tiles;
+	std::vector<unsigned short *> tileFlags; // by tile index, NULL while unmodified
+	std::map<int, std::vector<unsigned short>> storage;
+};
+
+/**
+ * A named query filter of a handle: include/exclude flags and per-area costs.
+ * Detour queries see it as a plain dtQueryFilter on the base flags; the
+ * handle applies the instance overlay around them (PassFlags), and its own
+ * searches use one of the non virtual views below.
+ */
+class NavFilterProfile : public dtQueryFilter
+{
+public:
+	NavFilterProfile() : overlay(NULL), uniformCost(true)
+	{
+		setIncludeFlags(0xffff);
+		setExcludeFlags(0);
+	}
+
+	// Both the base and the instance flags have to pass, so clearing a flag the
+	// profile excludes cannot open a poly either.
+	inline bool PassFlags(const dtMeshTile *tile, const dtPoly *poly) const
+	{
+		return PassFlags(poly->flags) && (!overlay || PassFlags(overlay->GetFlags(tile, poly)));
+	}
+
+	inline bool PassFlags(unsigned short flags) const
+	{
+		return (flags & getIncludeFlags()) != 0 && (flags & getExcludeFlags()) == 0;
+	}
+
+	void SetAreaCost(int area, float cost)
+	{
+		setAreaCost(area, cost);
+
+		uniformCost = true;
+		for (int i = 0; i < DT_MAX_AREAS; ++i)
+			uniformCost = uniformCost && getAreaCost(i) == 1.0f;
+	}
+
+	const NavFlagOverlay *overlay;
+	bool uniformCost; // every area costs 1, the cost is the plain distance
+};
+
+/** Non virtual view of a NavFilterProfile whose areas all cost 1. */
+struct NavUniformCostFilter
+{
+	explicit NavUniformCostFilter(const NavFilterProfile &profile) : profile(profile) {}
+
+	inline bool passFilter(const dtPolyRef ref, const dtMeshTile *tile, const dtPoly *poly) const
+	{
+		return profile.PassFlags(tile, poly);
+	}
+
+	inline float getCost(const float *pa, const float *pb, const dtPolyRef, const dtMeshTile *, const dtPoly *,
+						 const dtPolyRef, const dtMeshTile *, const dtPoly *, const dtPolyRef, const dtMeshTile *, const dtPoly *) const
+	{
+		return dtVdist(pa, pb);
+	}
+
+	const NavFilterProfile &profile;
+};
+
+/** Non virtual view of a NavFilterProfile with area costs, same costs as dtQueryFilter. */
+struct NavAreaCostFilter : NavUniformCostFilter
+{
+	explicit NavAreaCostFilter(const NavFilterProfile &profile) : NavUniformCostFilter(profile) {}
+
+	inline float getCost(const float *pa, const float *pb, const dtPolyRef, const dtMeshTile *, const dtPoly *,
+						 const dtPolyRef, const dtMeshTile *, const dtPoly *curPoly, const dtPolyRef, const dtMeshTile *, const dtPoly *) const
+	{
+		return dtVdist(pa, pb) * profile.getAreaCost(curPoly->getArea());
+	}
+};
+
+class RecastNavigationHandle
+{
+public:
+	static const int NAV_ERROR = -1;
+
+	static const int MAX_POLYS = 256;
+	static const int MAX_SEARCH_NODES = 1024;
+	static const int NAV_ERROR_NEARESTPOLY = -2;
+	static const int NAV_ERROR_UNREACHABLE = -3;
+
+	static const long RCN_NAVMESH_VERSION = 1;
+	static const int INVALID_NAVMESH_POLYREF = 0;
+
+	struct NavmeshLayer
+	{
+		dtNavMesh *pNavmesh;
+		dtNavMeshQuery *pNavmeshQuery;
+	};
+
+	struct CreateOptions
+	{
+		float heightCellSize;	  // > 0 builds a NavHeightGrid with this cell size
+		int landmarkCount;		  // > 0 enables ALT path search with this many landmarks
+		std::string landmarkPath; // sidecar file for the landmark tables, written when stale
+		bool reorderTiles;		  // Morton order polys and vertices of each tile before adding it
+		float visibilityCellSize; // > 0 builds a NavVisibility table with this cell size in the background
+		float visibilityRange;	  // pairs of cells further apart are not stored
+		std::string visibilityPath; // sidecar file for the visibility table, written when stale
+		float leanHeightError;	  // >= 0 replaces detail meshes within this height error by poly fans
+		int leanBvPolys;		  // tiles with at most this many polys drop their BV tree
+
+		CreateOptions() : heightCellSize(0.0f), landmarkCount(0), reorderTiles(false), visibilityCellSize(0.0f), visibilityRange(32.0f),
+						  leanHeightError(-1.0f), leanBvPolys(0) {}
+	};
+
+	// Per call search quality. The default is the exact search; anything else
+	// may return an approximate corridor.
+	struct PathQuality
+	{
+		float epsilon; // > 0 weights the heuristic by (1 + epsilon), paths cost at most that much more
+		int maxNodes;  // polys the search may visit, it stops at the budget with the best partial corridor
+
+		PathQuality() : epsilon(0.0f), maxNodes(MAX_SEARCH_NODES) {}
+
+		bool IsDefault() const
+		{
+			return epsilon <= 0.0f && maxNodes == MAX_SEARCH_NODES;
+		}
+	};
+
+	// FindStraightPath result flags, 0 means the path is optimal and complete
+	static const int NAV_PATH_APPROXIMATE = 1;	// weighted search
+	static const int NAV_PATH_PARTIAL = 2;		// ends short of the goal: closest poly reached or corridor cut at MAX_POLYS
+	static const int NAV_PATH_OUT_OF_NODES = 4; // the node budget was exhausted
+
+public:
+	RecastNavigationHandle()
+	{
+		navmeshLayer.pNavmesh = NULL;
+		navmeshLayer.pNavmeshQuery = NULL;
+		filters.resize(1);
+		filters[0].overlay = &overlay;
+	};
+
+	virtual ~RecastNavigationHandle()
+	{
+		// the navmesh itself belongs to 'shared'
+		dtFreeNavMeshQuery(navmeshLayer.pNavmeshQuery);
+	};
+
+	// True when none of 'polys' was disabled for 'filter' by this instance;
+	// Detour's own queries only see the base flags.
+	bool PassOverlay(const NavFilterProfile &filter, const dtPolyRef *polys, int npolys) const
+	{
+		if (!overlay.IsModified())
+			return true;
+
+		for (int i = 0; i < npolys; i++)
+		{
+			const dtMeshTile *tile = 0;
+			const dtPoly *poly = 0;
+			if (dtStatusSucceed(navmeshLayer.pNavmesh->getTileAndPolyByRef(polys[i], &tile, &poly)) && !filter.PassFlags(tile, poly))
+				return false;
+		}
+		return true;
+	}
+
+	// findNearestPoly honouring the overlay. When Detour's pick was disabled by
+	// this instance the polys in range are ranked again the way Detour does.
+	void FindNearestPoly(const float *pos, const float *extents, const NavFilterProfile &filter, dtPolyRef *ref, float *nearestPt)
+	{
+		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
+
+		*ref = INVALID_NAVMESH_POLYREF;
+		navmeshQuery->findNearestPoly(pos, extents, &filter, ref, nearestPt);
+		if (!*ref || PassOverlay(filter, ref, 1))
+			return;
+
+		dtPolyRef polys[MAX_POLYS];
+		int npolys = 0;
+		navmeshQuery->queryPolygons(pos, extents, &filter, polys, &npolys, MAX_POLYS);
+
+		*ref = INVALID_NAVMESH_POLYREF;
+		float nearestDist = FLT_MAX;
+		for (int i = 0; i < npolys; i++)
+		{
+			const dtMeshTile *tile = 0;
+			const dtPoly *poly = 0;
+			navmeshLayer.pNavmesh->getTileAndPolyByRefUnsafe(polys[i], &tile, &poly);
+			if (!filter.PassFlags(tile, poly))
+				continue;
+
+			float closest[3];
+			bool posOverPoly = false;
+			navmeshQuery->closestPointOnPoly(polys[i], pos, closest, &posOverPoly);
+
+			// standing over a poly counts as on it within the climb height
+			float diff[3];
+			dtVsub(diff, pos, closest);
+			float d;
+			if (posOverPoly)
+			{
+				d = dtAbs(diff[1]) - tile->header->walkableClimb;
+				d = d > 0 ? d * d : 0;
+			}
+			else
+				d = dtVlenSqr(diff);
+
+			if (d < nearestDist)
+			{
+				nearestDist = d;
+				*ref = polys[i];
+				dtVcopy(nearestPt, closest);
+			}
+		}
+	}
+
+	// Cuts a raycast result at the first visited poly this instance disabled:
+	// the ray stops where it leaves the poly before it. Returns the new 't'.
+	float ClipRayToOverlay(const NavFilterProfile &filter, const float *spos, const float *epos, float t, const dtPolyRef *polys, int *npolys) const
+	{
+		if (!overlay.IsModified())
+			return t;
+
+		for (int i = 1; i < *npolys; i++)
+		{
+			if (PassOverlay(filter, &polys[i], 1))
+				continue;
+
+			const dtMeshTile *tile = 0;
+			const dtPoly *poly = 0;
+			navmeshLayer.pNavmesh->getTileAndPolyByRefUnsafe(polys[i - 1], &tile, &poly);
+
+			float verts[DT_VERTS_PER_POLYGON * 3];
+			for (int k = 0; k < poly->vertCount; k++)
+				dtVcopy(&verts[k * 3], &tile->verts[poly->verts[k] * 3]);
+
+			float tmin, tmax;
+			int segMin, segMax;
+			*npolys = i;
+			if (dtIntersectSegmentPoly2D(spos, epos, verts, poly->vertCount, tmin, tmax, segMin, segMax))
+				return dtMin(t, tmax);
+			return t;
+		}
+		return t;
+	}
+
+	// Snaps both ends to the mesh and searches the poly corridor between them.
+	// Returns the corridor length or a NAV_ERROR_* code; 'status' tells whether
+	// the corridor is partial.
+	int FindCorridor(const float *spos, const float *epos, const NavFilterProfile &filter, dtPolyRef *polys, const int maxPolys,
+					 float *startNearestPt, float *endNearestPt, dtStatus *status, const PathQuality &quality = PathQuality())
+	{
+		const float extents[3] = {2.f, 4.f, 2.f};
+
+		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+		dtPolyRef endRef = INVALID_NAVMESH_POLYREF;
+
+		FindNearestPoly(spos, extents, filter, &startRef, startNearestPt);
+		FindNearestPoly(epos, extents, filter, &endRef, endNearestPt);
+
+		if (!startRef || !endRef)
+		{
+			//debuf_msg("NavMeshHandle::findStraightPath({%s}): Could not find any nearby poly's ({%d}, {%d})\n", resPath.c_str(), startRef, endRef);
+			return NAV_ERROR_NEARESTPOLY;
+		}
+
+		// different islands: findPath would only exhaust the node pool
+		if (!IsSameComponent(startRef, endRef))
+			return NAV_ERROR_UNREACHABLE;
+
+		// Detour's findPath for the plain query; the handle's own A* when it has
+		// something to add: a weighted or budgeted search, landmarks, or an
+		// overlay findPath's filter cannot see. Its non virtual filter is
+		// specialized for the common profile where every area costs the same.
+		int npolys = 0;
+		if (quality.IsDefault() && !GetLandmarks() && !overlay.IsModified())
+			*status = navmeshLayer.pNavmeshQuery->findPath(startRef, endRef, startNearestPt, endNearestPt, &filter, polys, &npolys, maxPolys);
+		else if (filter.uniformCost)
+			*status = FindPolyPath(startRef, endRef, startNearestPt, endNearestPt, NavUniformCostFilter(filter), polys, &npolys, maxPolys, quality);
+		else
+			*status = FindPolyPath(startRef, endRef, startNearestPt, endNearestPt, NavAreaCostFilter(filter), polys, &npolys, maxPolys, quality);
+
+		return npolys;
+	}
+
+	// Fills 'straightPath' (MAX_POLYS xyz) and the poly of each corner, returns
+	// the corner count or a NAV_ERROR_* code. 'resultFlags' receives NAV_PATH_*.
+	int FindStraightCorners(const NFVector3 &start, const NFVector3 &end, float *straightPath, dtPolyRef *straightPathPolys,
+							const PathQuality &quality = PathQuality(), int *resultFlags = NULL, int filterId = 0)
+	{
+		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
+
+		float spos[3];
+		spos[0] = start.X();
+		spos[1] = start.Y();
+		spos[2] = start.Z();
+
+		float epos[3];
+		epos[0] = end.X();
+		epos[1] = end.Y();
+		epos[2] = end.Z();
+
+		const NavFilterProfile &filter = GetFilter(filterId);
+
+		dtPolyRef polys[MAX_POLYS];
+		float startNearestPt[3];
+		float endNearestPt[3];
+		dtStatus status = 0;
+
+		int npolys = FindCorridor(spos, epos, filter, polys, MAX_POLYS, startNearestPt, endNearestPt, &status, quality);
+		if (npolys <= 0)
+			return npolys;
+
+		// a corridor cut at maxPolys stops short of the goal just the same
+		const bool partial = dtStatusDetail(status, DT_PARTIAL_RESULT) || dtStatusDetail(status, DT_BUFFER_TOO_SMALL);
+
+		if (resultFlags)
+		{
+			*resultFlags = quality.epsilon > 0.0f ? NAV_PATH_APPROXIMATE : 0;
+			if (partial)
+				*resultFlags |= NAV_PATH_PARTIAL;
+			if (dtStatusDetail(status, DT_OUT_OF_NODES))
+				*resultFlags |= NAV_PATH_OUT_OF_NODES;
+		}
+
+		unsigned char straightPathFlags[MAX_POLYS];
+		int nstraightPath = 0;
+
+		float epos1[3];
+		dtVcopy(epos1, endNearestPt);
+
+		if (partial)
+			navmeshQuery->closestPointOnPoly(polys[npolys - 1], endNearestPt, epos1, 0);
+
+		navmeshQuery->findStraightPath(startNearestPt, epos1, polys, npolys, straightPath, straightPathFlags, straightPathPolys, &nstraightPath, MAX_POLYS);
+		return nstraightPath;
+	}
+
+	int FindStraightPath(const NFVector3 &start, const NFVector3 &end, std::vector<NFVector3> &paths,
+						 const PathQuality &quality = PathQuality(), int *resultFlags = NULL, int filterId = 0)
+	{
+		float straightPath[MAX_POLYS * 3];
+		dtPolyRef straightPathPolys[MAX_POLYS];
+
+		int nstraightPath = FindStraightCorners(start, end, straightPath, straightPathPolys, quality, resultFlags, filterId);
+		if (nstraightPath < 0)
+			return nstraightPath;
+
+		NFVector3 currpos;
+		for (int i = 0; i < nstraightPath * 3;)
+		{
+			currpos.SetX(straightPath[i++]);
+			currpos.SetY(straightPath[i++]);
+			currpos.SetZ(straightPath[i++]);
+			paths.push_back(currpos);
+		}
+
+		return nstraightPath;
+	}
+
+	// Same path as FindStraightPath, appended to 'out' in the NavPathEncode
+	// layout quantized to 'step' around the navmesh origin. With 'withFlags'
+	// every corner carries the (instance) flags of the poly it enters.
+	int FindStraightPathPacked(const NFVector3 &start, const NFVector3 &end, float step, bool withFlags, std::string &out,
+							   const PathQuality &quality = PathQuality(), int *resultFlags = NULL, int filterId = 0)
+	{
+		float straightPath[MAX_POLYS * 3];
+		dtPolyRef straightPathPolys[MAX_POLYS];
+
+		int nstraightPath = FindStraightCorners(start, end, straightPath, straightPathPolys, quality, resultFlags, filterId);
+		if (nstraightPath <= 0)
+			return nstraightPath;
+
+		unsigned short flags[MAX_POLYS];
+		if (withFlags)
+		{
+			const dtNavMesh *mesh = shared->pNavmesh;
+			for (int i = 0; i < nstraightPath; i++)
+			{
+				const dtMeshTile *tile = NULL;
+				const dtPoly *poly = NULL;
+				// the end corner has no poly
+				flags[i] = straightPathPolys[i] && dtStatusSucceed(mesh->getTileAndPolyByRef(straightPathPolys[i], &tile, &poly)) ? overlay.GetFlags(tile, poly) : 0;
+			}
+		}
+
+		NavPathEncode(GetOrigin(), step, straightPath, nstraightPath, withFlags ? flags : NULL, out);
+		return nstraightPath;
+	}
+
+	const float *GetOrigin() const
+	{
+		return shared->pNavmesh->getParams()->orig;
+	}
+
+	int FindRandomPointAroundCircle(const NFVector3 &centerPos, std::vector<NFVector3> &points, int maxPoints, float maxRadius, int filterId = 0)
+	{
+		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
+
+		const NavFilterProfile &filter = GetFilter(filterId);
+
+		// Detour picks on the base flags, points on polys this instance
+		// disabled are dropped
+		if (maxRadius <= 0.0001f)
+		{
+			NFVector3 currpos;
+
+			for (int i = 0; i < maxPoints; i++)
+			{
+				float pt[3];
+				dtPolyRef ref;
+				dtStatus status = navmeshQuery->findRandomPoint(&filter, frand, &ref, pt);
+				if (dtStatusSucceed(status) && PassOverlay(filter, &ref, 1))
+				{
+					currpos.SetX(pt[0]);
+					currpos.SetY(pt[1]);
+					currpos.SetZ(pt[2]);
+
+					points.push_back(currpos);
+				}
+			}
+
+			return (int)points.size();
+		}
+
+		const float extents[3] = {2.f, 4.f, 2.f};
+
+		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+
+		float spos[3];
+		spos[0] = centerPos.X();
+		spos[1] = centerPos.Y();
+		spos[2] = centerPos.Z();
+
+		float startNearestPt[3];
+		FindNearestPoly(spos, extents, filter, &startRef, startNearestPt);
+
+		if (!startRef)
+		{
+			//debuf_msg("NavMeshHandle::findRandomPointAroundCircle({%s}): Could not find any nearby poly's ({%d})\n", resPath, startRef);
+			return NAV_ERROR_NEARESTPOLY;
+		}
+
+		NFVector3 currpos;
+		bool done = false;
+		int itry = 0;
+
+		while (itry++ < 3 && points.size() == 0)
+		{
+			maxPoints -= (int)points.size();
+
+			for (int i = 0; i < maxPoints; i++)
+			{
+				float pt[3];
+				dtPolyRef ref;
+				dtStatus status = navmeshQuery->findRandomPointAroundCircle(startRef, spos, maxRadius, &filter, frand, &ref, pt);
+
+				if (dtStatusSucceed(status))
+				{
+					done = true;
+					currpos.SetX(pt[0]);
+					currpos.SetY(pt[1]);
+					currpos.SetZ(pt[2]);
+
+					NFVector3 v = centerPos - currpos;
+					float dist_len = v.Length();
+					if (dist_len > maxRadius || !PassOverlay(filter, &ref, 1))
+						continue;
+
+					points.push_back(currpos);
+				}
+			}
+
+			if (!done)
+				break;
+		}
+
+		return (int)points.size();
+	}
+
+	int Raycast(const NFVector3 &start, const NFVector3 &end, std::vector<NFVector3> &hitPointVec, int filterId = 0)
+	{
+		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
+
+		float hitPoint[3];
+
+		float spos[3];
+		spos[0] = start.X();
+		spos[1] = start.Y();
+		spos[2] = start.Z();
+
+		float epos[3];
+		epos[0] = end.X();
+		epos[1] = end.Y();
+		epos[2] = end.Z();
+
+		const NavFilterProfile &filter = GetFilter(filterId);
+
+		const float extents[3] = {2.f, 4.f, 2.f};
+
+		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+
+		float nearestPt[3];
+		FindNearestPoly(spos, extents, filter, &startRef, nearestPt);
+
+		if (!startRef)
+		{
+			return NAV_ERROR_NEARESTPOLY;
+		}
+
+		float t = 0;
+		float hitNormal[3];
+		memset(hitNormal, 0, sizeof(hitNormal));
+
+		dtPolyRef polys[MAX_POLYS];
+		int npolys;
+
+		navmeshQuery->raycast(startRef, spos, epos, &filter, &t, hitNormal, polys, &npolys, MAX_POLYS);
+		t = ClipRayToOverlay(filter, spos, epos, t, polys, &npolys);
+
+		if (t > 1)
+		{
+			// no hit
+			return NAV_ERROR;
+		}
+		else
+		{
+			// Hit
+			hitPoint[0] = spos[0] + (epos[0] - spos[0]) * t;
+			hitPoint[1] = spos[1] + (epos[1] - spos[1]) * t;
+			hitPoint[2] = spos[2] + (epos[2] - spos[2]) * t;
+			if (npolys)
+			{
+				float h = 0;
+				navmeshQuery->getPolyHeight(polys[npolys - 1], hitPoint, &h);
+				hitPoint[1] = h;
+			}
+		}
+
+		hitPointVec.push_back(NFVector3(hitPoint[0], hitPoint[1], hitPoint[2]));
+		return 1;
+	}
+
+	// Returns 1 when 'end' can be seen from 'start' along the mesh, 0 when not,
+	// NAV_ERROR_NEARESTPOLY when 'start' is off the mesh. With 'approximate' a
+	// pair of cells the visibility table samples as blocked answers 0 without
+	// a raycast, which may miss a line of sight the samples did not cover.
+	int HasLineOfSight(const NFVector3 &start, const NFVector3 &end, int filterId = 0, bool approximate = false)
+	{
+		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
+
+		float spos[3] = {start.X(), start.Y(), start.Z()};
+		float epos[3] = {end.X(), end.Y(), end.Z()};
+
+		const NavFilterProfile &filter = GetFilter(filterId);
+
+		const float extents[3] = {2.f, 4.f, 2.f};
+
+		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+
+		float nearestPt[3];
+		FindNearestPoly(spos, extents, filter, &startRef, nearestPt);
+		if (!startRef)
+			return NAV_ERROR_NEARESTPOLY;
+
+		if (approximate && LookupVisibility(spos, epos) == NavVisibility::VIS_BLOCKED)
+			return 0;
+
+		float t = 0;
+		float hitNormal[3];
+		dtPolyRef polys[MAX_POLYS];
+		int npolys = 0;
+		navmeshQuery->raycast(startRef, spos, epos, &filter, &t, hitNormal, polys, &npolys, MAX_POLYS);
+		t = ClipRayToOverlay(filter, spos, epos, t, polys, &npolys);
+		return t > 1 ? 1 : 0;
+	}
+
+	// The table is sampled on the base flags with every flag included. Profiles
+	// and the overlay can only take polys away, so a sampled ray blocked there
+	// is blocked for them too; the answer is still only as good as the samples.
+	int LookupVisibility(const float *spos, const float *epos)
+	{
+		const NavVisibility *visibility = GetVisibility();
+		return visibility ? visibility->Lookup(spos, epos) : NavVisibility::VIS_UNKNOWN;
+	}
+
+	bool IsSameComponent(dtPolyRef a, dtPolyRef b) const
+	{
+		uint32_t ca = shared->components.Get(shared->polyIndex.Index(a));
+		return ca != NavComponents::NONE && ca == shared->components.Get(shared->polyIndex.Index(b));
+	}
+
+	int IsReachable(const NFVector3 &start, const NFVector3 &end, int filterId = 0)
+	{
+		float spos[3] = {start.X(), start.Y(), start.Z()};
+		float epos[3] = {end.X(), end.Y(), end.Z()};
+
+		const NavFilterProfile &filter = GetFilter(filterId);
+
+		const float extents[3] = {2.f, 4.f, 2.f};
+
+		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+		dtPolyRef endRef = INVALID_NAVMESH_POLYREF;
+
+		float nearestPt[3];
+		FindNearestPoly(spos, extents, filter, &startRef, nearestPt);
+		FindNearestPoly(epos, extents, filter, &endRef, nearestPt);
+
+		if (!startRef || !endRef)
+			return NAV_ERROR_NEARESTPOLY;
+
+		if (!IsSameComponent(startRef, endRef))
+			return NAV_ERROR_UNREACHABLE;
+
+		// components are those of the base mesh with every flag included, polys
+		// this instance disabled or the profile excludes may still split one;
+		// only a search over the whole component can tell
+		if (overlay.IsModified() || &filter != &filters[0])
+		{
+			PathQuality quality;
+			quality.maxNodes = shared->polyIndex.Count();
+
+			dtPolyRef first;
+			int npolys = 0;
+			dtStatus status = FindPolyPath(startRef, endRef, spos, epos, NavUniformCostFilter(filter), &first, &npolys, 1, quality);
+			if (dtStatusFailed(status) || (status & DT_PARTIAL_RESULT))
+				return NAV_ERROR_UNREACHABLE;
+		}
+		return 1;
+	}
+
+	// A* over the poly graph with the costs of dtNavMeshQuery::findPath, except
+	// that a node sits on the portal of its current parent, using the landmark
+	// bound as heuristic where it beats the Euclidean one. At most
+	// quality.maxNodes polys are visited; if the goal is not reached the path
+	// leads to the visited poly closest to it. A non default quality is a
+	// budget: the search stops as soon as it runs out of nodes instead of
+	// draining the open list.
+	template <class Filter>
+	dtStatus FindPolyPath(dtPolyRef startRef, dtPolyRef endRef, const float *startPos, const float *endPos, const Filter &filter,
+						  dtPolyRef *path, int *pathCount, const int maxPath, const PathQuality &quality = PathQuality())
+	{
+		static const float H_SCALE = 0.999f; // same as findPath
+
+		const float weight = 1.0f + dtMax(quality.epsilon, 0.0f);
+		const int maxNodes = quality.maxNodes;
+		const bool budgeted = !quality.IsDefault();
+
+		const dtNavMesh *mesh = navmeshLayer.pNavmesh;
+		const NavPolyIndex &polyIndex = shared->polyIndex;
+		const NavLandmarks *landmarks = GetLandmarks();
+		*pathCount = 0;
+
+		if (!startRef || !endRef || !maxPath)
+			return DT_FAILURE | DT_INVALID_PARAM;
+
+		if (startRef == endRef)
+		{
+			path[0] = startRef;
+			*pathCount = 1;
+			return DT_SUCCESS;
+		}
+
+		const uint32_t startIdx = polyIndex.Index(startRef);
+		const uint32_t endIdx = polyIndex.Index(endRef);
+
+		NavGraphSearch &search = Scratch();
+		search.Reset(polyIndex.Count());
+
+		NavGraphSearch::Node &startNode = search.Get(startIdx);
+		dtVcopy(startNode.pos, startPos);
+		startNode.cost = 0;
+		startNode.total = dtVdist(startPos, endPos) * H_SCALE;
+		if (landmarks)
+			startNode.total = dtMax(startNode.total, landmarks->Heuristic(startIdx, endIdx));
+		startNode.total *= weight;
+		startNode.state = NavGraphSearch::NODE_OPEN;
+		startNode.touched = 1;
+		search.Push(startIdx, startNode.total);
+
+		uint32_t lastBestIdx = startIdx;
+		float lastBestCost = startNode.total;
+		int nodeCount = 1;
+		bool outOfNodes = false;
+
+		uint32_t bestIdx;
+		while ((bestIdx = search.Pop()) != NavPolyIndex::INVALID)
+		{
+			if (bestIdx == endIdx)
+			{
+				lastBestIdx = bestIdx;
+				break;
+			}
+
+			NavGraphSearch::Node &best = search.nodes[bestIdx];
+			const dtPolyRef bestRef = polyIndex.refs[bestIdx];
+			const dtMeshTile *bestTile = 0;
+			const dtPoly *bestPoly = 0;
+			mesh->getTileAndPolyByRefUnsafe(bestRef, &bestTile, &bestPoly);
+
+			dtPolyRef parentRef = 0;
+			const dtMeshTile *parentTile = 0;
+			const dtPoly *parentPoly = 0;
+			if (best.parent != NavPolyIndex::INVALID)
+			{
+				parentRef = polyIndex.refs[best.parent];
+				mesh->getTileAndPolyByRefUnsafe(parentRef, &parentTile, &parentPoly);
+			}
+
+			for (unsigned int i = bestPoly->firstLink; i != DT_NULL_LINK; i = bestTile->links[i].next)
+			{
+				const dtPolyRef neighbourRef = bestTile->links[i].ref;
+				if (!neighbourRef || neighbourRef == parentRef)
+					continue;
+
+				const dtMeshTile *neighbourTile = 0;
+				const dtPoly *neighbourPoly = 0;
+				mesh->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
+				if (!filter.passFilter(neighbourRef, neighbourTile, neighbourPoly))
+					continue;
+
+				const uint32_t neighbourIdx = polyIndex.Index(neighbourRef);
+				NavGraphSearch::Node &neighbour = search.Get(neighbourIdx);
+				if (!neighbour.touched)
+				{
+					if (nodeCount >= maxNodes)
+					{
+						outOfNodes = true;
+						continue;
+					}
+					nodeCount++;
+					neighbour.touched = 1;
+				}
+
+				// unlike findPath a node moves to the portal of its cheapest parent,
+				// so every leg is one the landmark tables measured
+				float pos[3];
+				NavPortalMidpoint(bestRef, bestTile, bestPoly, bestTile->links[i], neighbourTile, neighbourPoly, pos);
+
+				float cost, heuristic;
+				if (neighbourRef == endRef)
+				{
+					const float curCost = filter.getCost(best.pos, pos, parentRef, parentTile, parentPoly,
+														 bestRef, bestTile, bestPoly, neighbourRef, neighbourTile, neighbourPoly);
+					const float endCost = filter.getCost(pos, endPos, bestRef, bestTile, bestPoly,
+														 neighbourRef, neighbourTile, neighbourPoly, 0, 0, 0);
+					cost = best.cost + curCost + endCost;
+					heuristic = 0;
+				}
+				else
+				{
+					cost = best.cost + filter.getCost(best.pos, pos, parentRef, parentTile, parentPoly,
+													  bestRef, bestTile, bestPoly, neighbourRef, neighbourTile, neighbourPoly);
+					heuristic = dtVdist(pos, endPos) * H_SCALE;
+					if (landmarks)
+						heuristic = dtMax(heuristic, landmarks->Heuristic(neighbourIdx, endIdx));
+					heuristic *= weight;
+				}
+
+				const float total = cost + heuristic;
+				if (neighbour.state != 0 && total >= neighbour.total)
+					continue;
+
+				dtVcopy(neighbour.pos, pos);
+				neighbour.parent = bestIdx;
+				neighbour.cost = cost;
+				neighbour.total = total;
+				neighbour.state = NavGraphSearch::NODE_OPEN;
+				search.Push(neighbourIdx, total);
+
+				if (heuristic < lastBestCost)
+				{
+					lastBestCost = heuristic;
+					lastBestIdx = neighbourIdx;
+				}
+			}
+
+			if (outOfNodes && budgeted)
+				break;
+		}
+
+		// like getPathToNode: keep the first maxPath polys of a longer path
+		int length = 0;
+		for (uint32_t n = lastBestIdx; n != NavPolyIndex::INVALID; n = search.nodes[n].parent)
+			length++;
+
+		uint32_t n = lastBestIdx;
+		for (int skip = length - maxPath; skip > 0; skip--)
+			n = search.nodes[n].parent;
+
+		const int writeCount = dtMin(length, maxPath);
+		for (int i = writeCount - 1; i >= 0; i--)
+		{
+			path[i] = polyIndex.refs[n];
+			n = search.nodes[n].parent;
+		}
+		*pathCount = writeCount;
+
+		dtStatus status = DT_SUCCESS;
+		if (lastBestIdx != endIdx)
+			status |= DT_PARTIAL_RESULT;
+		if (outOfNodes)
+			status |= DT_OUT_OF_NODES;
+		if (length > maxPath)
+			status |= DT_BUFFER_TOO_SMALL;
+		return status;
+	}
+
+	// Single source Dijkstra over the poly graph from 'origin', bounded by
+	// 'maxDist'. costs[i] receives the walking distance to candidates[i] or -1
+	// when it is off-mesh, unreachable or further than maxDist. With 'nearestOnly'
+	// the search stops as soon as the closest candidate is settled and only its
+	// entry is filled. Costs are those of profile 'filterId'. Returns the
+	// number of candidates in range.
+	int FindWalkingDistances(const NFVector3 &origin, const std::vector<NFVector3> &candidates, float maxDist, bool nearestOnly,
+							 std::vector<float> &costs, int filterId = 0)
+	{
+		const NavFilterProfile &profile = GetFilter(filterId);
+		if (profile.uniformCost)
+			return FindWalkingDistances(origin, candidates, maxDist, nearestOnly, costs, profile, NavUniformCostFilter(profile));
+		return FindWalkingDistances(origin, candidates, maxDist, nearestOnly, costs, profile, NavAreaCostFilter(profile));
+	}
+
+	template <class Filter>
+	int FindWalkingDistances(const NFVector3 &origin, const std::vector<NFVector3> &candidates, float maxDist, bool nearestOnly,
+							 std::vector<float> &costs, const NavFilterProfile &profile, const Filter &filter)
+	{
+		const dtNavMesh *mesh = navmeshLayer.pNavmesh;
+		const NavPolyIndex &polyIndex = shared->polyIndex;
+
+		costs.assign(candidates.size(), -1.0f);
+
+		const float extents[3] = {2.f, 4.f, 2.f};
+
+		float spos[3] = {origin.X(), origin.Y(), origin.Z()};
+		float startNearestPt[3];
+		dtPolyRef startRef = INVALID_NAVMESH_POLYREF;
+		FindNearestPoly(spos, extents, profile, &startRef, startNearestPt);
+		if (!startRef)
+			return NAV_ERROR_NEARESTPOLY;
+
+		// (poly index, candidate) sorted, so a settled poly finds its candidates by binary search
+		std::vector<std::pair<uint32_t, int>> targets;
+		std::vector<float> targetPts(candidates.size() * 3);
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			float pos[3] = {candidates[i].X(), candidates[i].Y(), candidates[i].Z()};
+			dtPolyRef ref = INVALID_NAVMESH_POLYREF;
+			FindNearestPoly(pos, extents, profile, &ref, &targetPts[i * 3]);
+			if (!ref || !IsSameComponent(startRef, ref))
+				continue;
+
+			targets.push_back(std::make_pair(polyIndex.Index(ref), (int)i));
+		}
+
+		if (targets.empty())
+			return 0;
+		std::sort(targets.begin(), targets.end());
+
+		int found = 0;
+		int remaining = (int)targets.size();
+		int nearest = -1;
+		float nearestCost = FLT_MAX;
+
+		NavGraphSearch &search = Scratch();
+		search.Reset(polyIndex.Count());
+
+		uint32_t startIdx = polyIndex.Index(startRef);
+		NavGraphSearch::Node &startNode = search.Get(startIdx);
+		dtVcopy(startNode.pos, startNearestPt);
+		startNode.cost = 0;
+		startNode.total = 0;
+		startNode.state = NavGraphSearch::NODE_OPEN;
+		startNode.touched = 1;
+		search.Push(startIdx, 0);
+
+		uint32_t bestIdx;
+		while ((bestIdx = search.Pop()) != NavPolyIndex::INVALID)
+		{
+			NavGraphSearch::Node &best = search.nodes[bestIdx];
+			if (best.cost > maxDist || best.cost >= nearestCost)
+				break;
+
+			const dtPolyRef bestRef = polyIndex.refs[bestIdx];
+			const dtMeshTile *bestTile = 0;
+			const dtPoly *bestPoly = 0;
+			mesh->getTileAndPolyByRefUnsafe(bestRef, &bestTile, &bestPoly);
+
+			// settle the candidates standing on this poly
+			std::vector<std::pair<uint32_t, int>>::iterator it = std::lower_bound(targets.begin(), targets.end(), std::make_pair(bestIdx, -1));
+			for (; it != targets.end() && it->first == bestIdx; ++it)
+			{
+				remaining--;
+
+				const float *pt = &targetPts[it->second * 3];
+				float cost = best.cost + filter.getCost(best.pos, pt, 0, NULL, NULL, bestRef, bestTile, bestPoly, 0, NULL, NULL);
+				if (cost > maxDist)
+					continue;
+
+				if (!nearestOnly)
+				{
+					costs[it->second] = cost;
+					found++;
+				}
+				else if (cost < nearestCost)
+				{
+					nearestCost = cost;
+					nearest = it->second;
+				}
+			}
+
+			if (remaining == 0)
+				break;
+
+			dtPolyRef parentRef = 0;
+			const dtMeshTile *parentTile = 0;
+			const dtPoly *parentPoly = 0;
+			if (best.parent != NavPolyIndex::INVALID)
+			{
+				parentRef = polyIndex.refs[best.parent];
+				mesh->getTileAndPolyByRefUnsafe(parentRef, &parentTile, &parentPoly);
+			}
+
+			for (unsigned int i = bestPoly->firstLink; i != DT_NULL_LINK; i = bestTile->links[i].next)
+			{
+				const dtPolyRef neighbourRef = bestTile->links[i].ref;
+				if (!neighbourRef || neighbourRef == parentRef)
+					continue;
+
+				const dtMeshTile *neighbourTile = 0;
+				const dtPoly *neighbourPoly = 0;
+				mesh->getTileAndPolyByRefUnsafe(neighbourRef, &neighbourTile, &neighbourPoly);
+				if (!filter.passFilter(neighbourRef, neighbourTile, neighbourPoly))
+					continue;
+
+				const uint32_t neighbourIdx = polyIndex.Index(neighbourRef);
+				NavGraphSearch::Node &neighbour = search.Get(neighbourIdx);
+				if (neighbour.state == NavGraphSearch::NODE_CLOSED)
+					continue;
+
+				// like findPath, a node keeps the portal position it was first reached through
+				if (!neighbour.touched)
+				{
+					NavPortalMidpoint(bestRef, bestTile, bestPoly, bestTile->links[i], neighbourTile, neighbourPoly, neighbour.pos);
+					neighbour.touched = 1;
+				}
+
+				const float cost = best.cost + filter.getCost(best.pos, neighbour.pos, parentRef, parentTile, parentPoly,
+															  bestRef, bestTile, bestPoly, neighbourRef, neighbourTile, neighbourPoly);
+				if (cost > maxDist || cost >= neighbour.cost)
+					continue;
+
+				neighbour.parent = bestIdx;
+				neighbour.cost = cost;
+				neighbour.total = cost;
+				neighbour.state = NavGraphSearch::NODE_OPEN;
+				search.Push(neighbourIdx, cost);
+			}
+		}
+
+		if (nearestOnly && nearest >= 0)
+		{
+			costs[nearest] = nearestCost;
+			found = 1;
+		}
+
+		return found;
+	}
+
+	// Scratch of the handle's own searches. One per thread, shared by all the
+	// handles and instances on it, so none carries a poly count sized array.
+	static NavGraphSearch &Scratch()
+	{
+		static thread_local NavGraphSearch search;
+		return search;
+	}
+
+	// Registers a filter profile and returns its id. 'areaCosts' holds
+	// DT_MAX_AREAS costs or is NULL for cost 1 everywhere; costs below 1 make
+	// the distance heuristics overestimate, as with Detour's findPath.
+	int AddFilter(unsigned short includeFlags, unsigned short excludeFlags, const float *areaCosts)
+	{
+		NavFilterProfile profile;
+		profile.overlay = &overlay;
+		profile.setIncludeFlags(includeFlags);
+		profile.setExcludeFlags(excludeFlags);
+		for (int i = 0; areaCosts && i < DT_MAX_AREAS; ++i)
+			profile.SetAreaCost(i, areaCosts[i]);
+
+		filters.push_back(profile);
+		return (int)filters.size() - 1;
+	}
+
+	// Unknown ids fall back to the default profile.
+	const NavFilterProfile &GetFilter(int filterId) const
+	{
+		return filterId > 0 && filterId < (int)filters.size() ? filters[filterId] : filters[0];
+	}
+
+	// Tiles of a navmesh that was ever shared with instances are immutable.
+	dtStatus AddTile(unsigned char *data, int dataSize, int flags, dtTileRef lastRef, dtTileRef *result)
+	{
+		if (shared->frozen)
+			return DT_FAILURE | DT_INVALID_PARAM;
+
+		if (options.reorderTiles)
+			NavTileReorder::Apply(data, dataSize);
+
+		StopBackgroundBuilds();
+		dtStatus status = navmeshLayer.pNavmesh->addTile(data, dataSize, flags, lastRef, result);
+		if (dtStatusSucceed(status))
+			OnTilesChanged();
+		return status;
+	}
+
+	dtStatus RemoveTile(dtTileRef ref, unsigned char **data, int *dataSize)
+	{
+		if (shared->frozen)
+			return DT_FAILURE | DT_INVALID_PARAM;
+
+		StopBackgroundBuilds();
+		dtStatus status = navmeshLayer.pNavmesh->removeTile(ref, data, dataSize);
+		if (dtStatusSucceed(status))
+			OnTilesChanged();
+		return status;
+	}
+
+	// The PVS thread reads tiles and links, it must be gone before addTile or
+	// removeTile rewrites them. A cancelled build is redone on next use, also
+	// when the tile change itself fails.
+	void StopBackgroundBuilds()
+	{
+		if (!shared->pVisibility)
+			return;
+
+		shared->pVisibility->Stop();
+		if (!shared->pVisibility->IsReady())
+			shared->stale |= NavmeshShared::STALE_VISIBILITY;
+	}
+
+	// Rebuilds the cheap tables derived from the tile set (bounds, poly index,
+	// components) and drops the slow ones until they are next used. Called
+	// whenever tiles are added or removed.
+	void OnTilesChanged()
+	{
+		const dtNavMesh *mesh = navmeshLayer.pNavmesh;
+		float *bmin = shared->bmin;
+		float *bmax = shared->bmax;
+
+		dtVset(bmin, FLT_MAX, FLT_MAX, FLT_MAX);
+		dtVset(bmax, -FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (int i = 0; i < mesh->getMaxTiles(); ++i)
+		{
+			const dtMeshTile *tile = mesh->getTile(i);
+			if (!tile || !tile->header)
+				continue;
+
+			dtVmin(bmin, tile->header->bmin);
+			dtVmax(bmax, tile->header->bmax);
+		}
+
+		overlay.Init(mesh);
+
+		shared->polyIndex.Build(mesh);
+		shared->components.Build(mesh, shared->polyIndex);
+
+		SAFE_RELEASE(shared->pLandmarks);
+		SAFE_RELEASE(shared->pVisibility);
+		SAFE_RELEASE(shared->pHeightGrid);
+		shared->stale = NavmeshShared::STALE_LANDMARKS | NavmeshShared::STALE_HEIGHT_GRID | NavmeshShared::STALE_VISIBILITY;
+	}
+
+	// The sidecar files describe the navmesh as loaded, so only the load path
+	// ('useFiles') reads and writes them; rebuilds after tile changes do not.
+	void BuildLandmarks(bool useFiles)
+	{
+		const dtNavMesh *mesh = navmeshLayer.pNavmesh;
+		shared->stale &= ~NavmeshShared::STALE_LANDMARKS;
+
+		SAFE_RELEASE(shared->pLandmarks);
+		if (options.landmarkCount > 0 && shared->polyIndex.Count() > 0)
+		{
+			NavLandmarks *landmarks = new NavLandmarks();
+			const char *path = options.landmarkPath.c_str();
+			const bool useFile = useFiles && !options.landmarkPath.empty();
+			if (!useFile || !landmarks->Load(path, mesh, shared->polyIndex, options.landmarkCount))
+			{
+				landmarks->Build(mesh, shared->polyIndex, options.landmarkCount);
+				if (useFile)
+					landmarks->Save(path, shared->polyIndex);
+			}
+			shared->pLandmarks = landmarks;
+		}
+	}
+
+	void BuildVisibility(bool useFiles)
+	{
+		const dtNavMesh *mesh = navmeshLayer.pNavmesh;
+		shared->stale &= ~NavmeshShared::STALE_VISIBILITY;
+
+		SAFE_RELEASE(shared->pVisibility);
+		if (options.visibilityCellSize > 0 && shared->polyIndex.Count() > 0)
+		{
+			NavVisibility *visibility = new NavVisibility();
+			if (visibility->Init(mesh, shared->bmin, shared->bmax, options.visibilityCellSize, options.visibilityRange))
+			{
+				visibility->Start(mesh, useFiles ? options.visibilityPath : std::string());
+				shared->pVisibility = visibility;
+			}
+			else
+				SAFE_RELEASE(visibility);
+		}
+	}
+
+	void BuildHeightGrid()
+	{
+		const dtNavMesh *mesh = navmeshLayer.pNavmesh;
+		shared->stale &= ~NavmeshShared::STALE_HEIGHT_GRID;
+
+		SAFE_RELEASE(shared->pHeightGrid);
+		if (options.heightCellSize > 0 && shared->polyIndex.Count() > 0)
+		{
+			NavHeightGrid *grid = new NavHeightGrid();
+			if (grid->Build(mesh, navmeshLayer.pNavmeshQuery, shared->bmin, shared->bmax, options.heightCellSize))
+				shared->pHeightGrid = grid;
+			else
+				SAFE_RELEASE(grid);
+		}
+	}
+
+	const NavLandmarks *GetLandmarks()
+	{
+		if (shared->stale & NavmeshShared::STALE_LANDMARKS)
+			BuildLandmarks(false);
+		return shared->pLandmarks;
+	}
+
+	const NavVisibility *GetVisibility()
+	{
+		if (shared->stale & NavmeshShared::STALE_VISIBILITY)
+			BuildVisibility(false);
+		return shared->pVisibility;
+	}
+
+	const NavHeightGrid *GetHeightGrid()
+	{
+		if (shared->stale & NavmeshShared::STALE_HEIGHT_GRID)
+			BuildHeightGrid();
+		return shared->pHeightGrid;
+	}
+
+	int GetHeight(float x, float z, float *height, const float *hintY = NULL)
+	{
+		float hint = hintY ? *hintY : (shared->bmin[1] + shared->bmax[1]) * 0.5f;
+		float extY = hintY ? 4.f : (shared->bmax[1] - shared->bmin[1]) * 0.5f + 1.f;
+
+		const NavHeightGrid *grid = GetHeightGrid();
+		if (grid)
+		{
+			float gridHint;
+			int res = grid->Sample(x, z, height, &gridHint);
+			if (res == NavHeightGrid::SAMPLE_OK)
+				return 1;
+			if (res == NavHeightGrid::SAMPLE_MISS)
+				return NAV_ERROR_NEARESTPOLY;
+
+			if (!hintY && gridHint > -FLT_MAX)
+			{
+				// no caller hint in a layered cell: resolve against the top layer
+				hint = gridHint;
+				extY = 4.f;
+			}
+		}
+
+		dtNavMeshQuery *navmeshQuery = navmeshLayer.pNavmeshQuery;
+
+		const dtQueryFilter &filter = filters[0];
+
+		const float extents[3] = {0.1f, extY, 0.1f};
+		float pos[3] = {x, hint, z};
+
+		dtPolyRef ref = INVALID_NAVMESH_POLYREF;
+		float nearestPt[3];
+		navmeshQuery->findNearestPoly(pos, extents, &filter, &ref, nearestPt);
+		if (!ref)
+			return NAV_ERROR_NEARESTPOLY;
+
+		if (dtStatusFailed(navmeshQuery->getPolyHeight(ref, pos, height)))
+			return NAV_ERROR_NEARESTPOLY;
+
+		return 1;
+	}
+
+	static RecastNavigationHandle *Create(std::string resPath, const CreateOptions &options = CreateOptions())
+	{
+		FILE *fp = fopen(resPath.c_str(), "rb");
+		if (!fp)
+		{
+			printf("RecastNavigationHandle::create: open({%s}) is error!\n", resPath.c_str());
+			return NULL;
+		}
+
+		printf("RecastNavigationHandle::create: ({%s}), layer={%d}\n", resPath.c_str(), 0);
+
+		bool safeStorage = true;
+		int pos = 0;
+		int size = sizeof(NavMeshSetHeader);
+
+		fseek(fp, 0, SEEK_END);
+		size_t flen = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		uint8_t *data = new uint8_t[flen];
+		if (data == NULL)
+		{
+			printf("RecastNavigationHandle::create: open({%s}), memory(size={%d}) error!\n", resPath.c_str(), (int)flen);
+
+			fclose(fp);
+			SAFE_RELEASE_ARRAY(data);
+			return NULL;
+		}
+
+		size_t readsize = fread(data, 1, flen, fp);
+		if (readsize != flen)
+		{
+			printf("RecastNavigationHandle::create: open({%s}), read(size={%d} != {%d}) error!\n", resPath.c_str(), (int)readsize, (int)flen);
+
+			fclose(fp);
+			SAFE_RELEASE_ARRAY(data);
+			return NULL;
+		}
+
+		if (readsize < sizeof(NavMeshSetHeader))
+		{
+			printf("RecastNavigationHandle::create: open({%s}), NavMeshSetHeader is error!\n", resPath.c_str());
+
+			fclose(fp);
+			SAFE_RELEASE_ARRAY(data);
+			return NULL;
+		}
+
+		NavMeshSetHeader header;
 		memcpy(&header, data, size);
 
 		pos += size;
@@ -636,6 +3174,8 @@ public:
 
 		// Read tiles.
 		bool success = true;
+		int reorderedCount = 0;
+		int leanSaved = 0;
 		for (int i = 0; i < header.tileCount; ++i)
 		{
 			NavMeshTileHeader tileHeader;
@@ -662,6 +3202,20 @@ public:
 			memcpy(tileData, &data[pos], size);
 			pos += size;
 
+			if (options.reorderTiles && NavTileReorder::Apply(tileData, size))
+				reorderedCount++;
+
+			unsigned char *leanData = NULL;
+			int leanSize = 0;
+			if ((options.leanHeightError >= 0 || options.leanBvPolys > 0) &&
+				NavTileStrip::Apply(tileData, size, options.leanHeightError, options.leanBvPolys, &leanData, &leanSize))
+			{
+				leanSaved += size - leanSize;
+				dtFree(tileData);
+				tileData = leanData;
+				size = leanSize;
+			}
+
 			status = mesh->addTile(tileData, size, (safeStorage ? DT_TILE_FREE_DATA : 0), tileHeader.tileRef, 0);
 
 			if (dtStatusFailed(status))
@@ -682,10 +3236,12 @@ public:
 		}
 
 		RecastNavigationHandle *pNavMeshHandle = new RecastNavigationHandle();
-		dtNavMeshQuery *pNavmeshQuery = new dtNavMeshQuery();
+		dtNavMeshQuery *pNavmeshQuery = dtAllocNavMeshQuery();
 
-		pNavmeshQuery->init(mesh, 1024);
+		pNavmeshQuery->init(mesh, MAX_SEARCH_NODES);
 		pNavMeshHandle->resPath = resPath;
+		pNavMeshHandle->shared = std::make_shared<NavmeshShared>();
+		pNavMeshHandle->shared->pNavmesh = mesh;
 		pNavMeshHandle->navmeshLayer.pNavmeshQuery = pNavmeshQuery;
 		pNavMeshHandle->navmeshLayer.pNavmesh = mesh;
 
@@ -720,13 +3276,310 @@ public:
 		printf("\t==> {%d} polygons ({%d} vertices)\n", polyCount, vertCount);
 		printf("\t==> {%d} triangles ({%d} vertices)\n", triCount, triVertCount);
 		printf("\t==> {%f:.2f} MB of data (not including pointers)\n", (((float)dataSize / sizeof(unsigned char)) / 1048576));
+
+		pNavMeshHandle->options = options;
+		pNavMeshHandle->OnTilesChanged();
+		pNavMeshHandle->BuildLandmarks(true);
+		pNavMeshHandle->BuildVisibility(true);
+		pNavMeshHandle->BuildHeightGrid();
+
+		if (options.reorderTiles)
+			printf("\t==> {%d}/{%d} tiles reordered along Morton curve\n", reorderedCount, tileCount);
+		if (options.leanHeightError >= 0 || options.leanBvPolys > 0)
+			printf("\t==> lean load: {%d} bytes saved ({%.2f} MB)\n", leanSaved, ((float)leanSaved / 1048576));
+		printf("\t==> {%d} connected components\n", pNavMeshHandle->shared->components.count);
+
+		const NavLandmarks *landmarks = pNavMeshHandle->shared->pLandmarks;
+		if (landmarks)
+		{
+			printf("\t==> {%d} ALT landmarks ({%.2f} MB)\n", landmarks->count, ((float)landmarks->GetMemorySize() / 1048576));
+		}
+
+		const NavHeightGrid *grid = pNavMeshHandle->shared->pHeightGrid;
+		if (grid)
+		{
+			printf("\t==> height grid: {%d}x{%d} cell={%.2f} ({%d} layers, {%.2f} MB)\n", grid->width, grid->height,
+				   grid->cellSize, (int)grid->heights.size(), ((float)grid->GetMemorySize() / 1048576));
+		}
+
+		const NavVisibility *visibility = pNavMeshHandle->shared->pVisibility;
+		if (visibility)
+		{
+			printf("\t==> PVS: {%d}x{%d} cell={%.2f} window={%d} ({%s})\n", visibility->width, visibility->height,
+				   visibility->cellSize, visibility->window, visibility->IsReady() ? "loaded" : "building");
+		}
+
 		printf("\t==> ----------------RecastNavigationHandle Create------------------------\n");
 
 		return pNavMeshHandle;
 	}
 
+	// A new handle on the same navmesh and tables with its own query state and
+	// an empty flag overlay. Nothing tile sized is copied. The tiles of both
+	// handles are frozen from here on, even after the fork is gone.
+	RecastNavigationHandle *Fork()
+	{
+		shared->frozen = true;
+
+		dtNavMeshQuery *pNavmeshQuery = dtAllocNavMeshQuery();
+		if (!pNavmeshQuery || dtStatusFailed(pNavmeshQuery->init(shared->pNavmesh, MAX_SEARCH_NODES)))
+		{
+			printf("RecastNavigationHandle::Fork: ({%s}) query init is error!\n", resPath.c_str());
+			dtFreeNavMeshQuery(pNavmeshQuery);
+			return NULL;
+		}
+
+		RecastNavigationHandle *pNavMeshHandle = new RecastNavigationHandle();
+		pNavMeshHandle->resPath = resPath;
+		pNavMeshHandle->options = options;
+		pNavMeshHandle->shared = shared;
+		pNavMeshHandle->navmeshLayer.pNavmesh = shared->pNavmesh;
+		pNavMeshHandle->navmeshLayer.pNavmeshQuery = pNavmeshQuery;
+		pNavMeshHandle->overlay.Init(shared->pNavmesh);
+
+		// once shared the tables are read-only, finish any lazy rebuild first
+		pNavMeshHandle->GetLandmarks();
+		pNavMeshHandle->GetVisibility();
+		pNavMeshHandle->GetHeightGrid();
+		return pNavMeshHandle;
+	}
+
+	// Forks an instance of 'resPath'. The base is loaded once per process and
+	// freed with its last instance; the first caller's options win. Every
+	// caller gets a fork, the loaded handle itself is never handed out, so the
+	// mesh is frozen before any instance can touch it.
+	static RecastNavigationHandle *CreateInstance(std::string resPath, const CreateOptions &options = CreateOptions())
+	{
+		struct Base
+		{
+			std::weak_ptr<NavmeshShared> shared;
+			CreateOptions options; // the tables in 'shared' were built with these
+		};
+
+		static std::mutex lock;
+		static std::map<std::string, Base> bases;
+
+		std::lock_guard<std::mutex> guard(lock);
+
+		Base &entry = bases[resPath];
+
+		RecastNavigationHandle base;
+		base.resPath = resPath;
+		base.shared = entry.shared.lock();
+		base.options = entry.options;
+		if (!base.shared)
+		{
+			RecastNavigationHandle *pNavMeshHandle = Create(resPath, options);
+			if (!pNavMeshHandle)
+				return NULL;
+
+			base.shared = pNavMeshHandle->shared;
+			base.options = options;
+			base.shared->frozen = true;
+			entry.shared = base.shared;
+			entry.options = options;
+			delete pNavMeshHandle;
+		}
+		return base.Fork();
+	}
+
+	// Sets the flags of every poly overlapping the box on this handle only.
+	// Flags the base mesh does not have are dropped, an instance can disable
+	// polys but not open them. Returns the number of polys changed.
+	int SetPolyFlags(const NFVector3 &center, const NFVector3 &halfExtents, unsigned short flags)
+	{
+		float c[3] = {center.X(), center.Y(), center.Z()};
+		float e[3] = {halfExtents.X(), halfExtents.Y(), halfExtents.Z()};
+
+		// polys without base flags have nothing to clear
+		dtQueryFilter any;
+		any.setIncludeFlags(0xffff);
+		any.setExcludeFlags(0);
+
+		dtPolyRef polys[MAX_POLYS];
+		int npolys = 0;
+		navmeshLayer.pNavmeshQuery->queryPolygons(c, e, &any, polys, &npolys, MAX_POLYS);
+
+		int changed = 0;
+		for (int i = 0; i < npolys; i++)
+			changed += overlay.SetFlags(polys[i], flags) ? 1 : 0;
+		return changed;
+	}
+
+	void ResetPolyFlags()
+	{
+		overlay.Reset();
+	}
+
 	NavmeshLayer navmeshLayer;
 	std::string resPath;
+	CreateOptions options;
+	std::shared_ptr<NavmeshShared> shared;
+	NavFlagOverlay overlay;
+	std::vector<NavFilterProfile> filters; // profile 0 is the default, include all at cost 1
+};
+
+/**
+ * A path kept alive between queries: a dtPathCorridor the owner walks along
+ * with Advance() and reads a few corners at a time. Retarget() repairs the
+ * corridor locally instead of searching the whole path again. The corridor's
+ * Detour queries only see the base flags, so a corridor that ends up on a
+ * poly the instance disabled is searched again.
+ */
+class RecastNavigationPath
+{
+public:
+	static const int MAX_CORNERS = 16;
+
+	RecastNavigationPath(RecastNavigationHandle *handle, int filterId = 0) : handle(handle), filterId(filterId)
+	{
+		corridor.init(RecastNavigationHandle::MAX_POLYS);
+	}
+
+	int Init(const NFVector3 &start, const NFVector3 &end)
+	{
+		float spos[3] = {start.X(), start.Y(), start.Z()};
+		float epos[3] = {end.X(), end.Y(), end.Z()};
+
+		dtPolyRef polys[RecastNavigationHandle::MAX_POLYS];
+		float startNearestPt[3];
+		float endNearestPt[3];
+		dtStatus status = 0;
+
+		int npolys = handle->FindCorridor(spos, epos, handle->GetFilter(filterId), polys, RecastNavigationHandle::MAX_POLYS, startNearestPt, endNearestPt, &status);
+		if (npolys <= 0)
+			return npolys < 0 ? npolys : RecastNavigationHandle::NAV_ERROR;
+
+		if (dtStatusDetail(status, DT_PARTIAL_RESULT) || dtStatusDetail(status, DT_BUFFER_TOO_SMALL))
+			handle->navmeshLayer.pNavmeshQuery->closestPointOnPoly(polys[npolys - 1], endNearestPt, endNearestPt, 0);
+
+		corridor.reset(polys[0], startNearestPt);
+		corridor.setCorridor(endNearestPt, polys, npolys);
+		return npolys;
+	}
+
+	// Moves the corridor start to 'pos' (constrained to the mesh) and returns the
+	// resulting position.
+	NFVector3 Advance(const NFVector3 &pos)
+	{
+		const NavFilterProfile &filter = handle->GetFilter(filterId);
+		const dtPolyRef prevRef = corridor.getFirstPoly();
+		float prev[3];
+		dtVcopy(prev, corridor.getPos());
+
+		float npos[3] = {pos.X(), pos.Y(), pos.Z()};
+		corridor.movePosition(npos, handle->navmeshLayer.pNavmeshQuery, &filter);
+
+		// walked onto a disabled poly or the corridor ahead crosses one: stay
+		// and search again, or stop here when the target cannot be reached
+		if (!handle->PassOverlay(filter, corridor.getPath(), corridor.getPathCount()) &&
+			Init(NFVector3(prev[0], prev[1], prev[2]), GetTarget()) <= 0)
+			corridor.reset(prevRef, prev);
+
+		return GetPosition();
+	}
+
+	// The next 'maxCorners' straight path corners. Returns true when the last
+	// returned corner is the end of the path.
+	bool GetCorners(int maxCorners, std::vector<NFVector3> &corners)
+	{
+		float cornerVerts[MAX_CORNERS * 3];
+		unsigned char cornerFlags[MAX_CORNERS];
+		dtPolyRef cornerPolys[MAX_CORNERS];
+
+		maxCorners = dtClamp(maxCorners, 1, (int)MAX_CORNERS);
+		int ncorners = corridor.findCorners(cornerVerts, cornerFlags, cornerPolys, maxCorners, handle->navmeshLayer.pNavmeshQuery, &handle->GetFilter(filterId));
+		for (int i = 0; i < ncorners; i++)
+			corners.push_back(NFVector3(cornerVerts[i * 3], cornerVerts[i * 3 + 1], cornerVerts[i * 3 + 2]));
+
+		return ncorners > 0 && (cornerFlags[ncorners - 1] & DT_STRAIGHTPATH_END);
+	}
+
+	// Moves the path target. Small moves slide the target along the surface;
+	// otherwise the corridor is extended from its current end to the new target
+	// and any loop this creates is cut, falling back to a full search only when
+	// the merged corridor does not fit.
+	int Retarget(const NFVector3 &target)
+	{
+		dtNavMeshQuery *navmeshQuery = handle->navmeshLayer.pNavmeshQuery;
+
+		float npos[3] = {target.X(), target.Y(), target.Z()};
+		corridor.moveTargetPosition(npos, navmeshQuery, &handle->GetFilter(filterId));
+		if (dtVdist2DSqr(corridor.getTarget(), npos) < 0.01f * 0.01f)
+		{
+			corridor.optimizePathTopology(navmeshQuery, &handle->GetFilter(filterId));
+			return KeepToOverlay(target);
+		}
+
+		float from[3];
+		dtVcopy(from, corridor.getTarget());
+
+		dtPolyRef ext[RecastNavigationHandle::MAX_POLYS];
+		float fromNearestPt[3];
+		float endNearestPt[3];
+		dtStatus status = 0;
+
+		int next = handle->FindCorridor(from, npos, handle->GetFilter(filterId), ext, RecastNavigationHandle::MAX_POLYS, fromNearestPt, endNearestPt, &status);
+		if (next <= 0)
+			return next < 0 ? next : RecastNavigationHandle::NAV_ERROR;
+
+		if (dtStatusDetail(status, DT_PARTIAL_RESULT) || dtStatusDetail(status, DT_BUFFER_TOO_SMALL))
+			navmeshQuery->closestPointOnPoly(ext[next - 1], endNearestPt, endNearestPt, 0);
+
+		dtPolyRef merged[RecastNavigationHandle::MAX_POLYS];
+		int nmerged = corridor.getPathCount();
+		memcpy(merged, corridor.getPath(), sizeof(dtPolyRef) * nmerged);
+
+		bool fits = ext[0] == merged[nmerged - 1];
+		for (int i = 1; fits && i < next; i++)
+		{
+			int k = 0;
+			while (k < nmerged && merged[k] != ext[i])
+				k++;
+
+			if (k < nmerged)
+				nmerged = k + 1; // walked back onto the corridor, drop the loop
+			else if (nmerged < RecastNavigationHandle::MAX_POLYS)
+				merged[nmerged++] = ext[i];
+			else
+				fits = false;
+		}
+
+		if (!fits)
+		{
+			NFVector3 pos(corridor.getPos()[0], corridor.getPos()[1], corridor.getPos()[2]);
+			return Init(pos, target);
+		}
+
+		corridor.setCorridor(endNearestPt, merged, nmerged);
+		corridor.optimizePathTopology(navmeshQuery, &handle->GetFilter(filterId));
+		return KeepToOverlay(target);
+	}
+
+	NFVector3 GetPosition() const
+	{
+		return NFVector3(corridor.getPos()[0], corridor.getPos()[1], corridor.getPos()[2]);
+	}
+
+	NFVector3 GetTarget() const
+	{
+		return NFVector3(corridor.getTarget()[0], corridor.getTarget()[1], corridor.getTarget()[2]);
+	}
+
+private:
+	// Searches the whole path again when the corridor crosses a poly the
+	// instance disabled. Returns the corridor length or a NAV_ERROR_* code.
+	int KeepToOverlay(const NFVector3 &target)
+	{
+		if (handle->PassOverlay(handle->GetFilter(filterId), corridor.getPath(), corridor.getPathCount()))
+			return corridor.getPathCount();
+		return Init(GetPosition(), target);
+	}
+
+public:
+	RecastNavigationHandle *handle;
+	int filterId; // profile of the handle, looked up per call as profiles may be added meanwhile
+	dtPathCorridor corridor;
 };
 
 #endif
\ No newline at end of file
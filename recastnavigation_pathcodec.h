@@ -0,0 +1,137 @@
+#ifndef _RECASTNAVIGATION_PATHCODEC_H_
+#define _RECASTNAVIGATION_PATHCODEC_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Packed straight path layout (little endian):
+//   uint8   header   high nibble version, bit 0 set when poly flags follow each point
+//   float32 step     quantization grid size
+//   varint  count
+//   count x { zigzag varint dx, dy, dz [, varint polyFlags] }
+// Coordinates are quantized to round((v - orig) / step) with 'orig' the navmesh
+// params.orig, which both ends already know. The first point is stored relative
+// to the origin, every following one relative to the previous point.
+
+static const uint8_t NAV_PATH_CODEC_VERSION = 1;
+static const uint8_t NAV_PATH_CODEC_POLYFLAGS = 0x01;
+
+static inline void NavPathPutVarint(std::string &out, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((char)v);
+}
+
+static inline bool NavPathGetVarint(const unsigned char *&p, const unsigned char *end, uint32_t &v)
+{
+	v = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		if (p >= end)
+			return false;
+
+		uint32_t b = *p++;
+		v |= (b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static inline uint32_t NavPathZigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t NavPathUnzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/**
+ * Appends 'count' points (xyz triples) to 'out'. 'polyFlags' holds one entry per
+ * point or is NULL to leave the flags out.
+ */
+static void NavPathEncode(const float *orig, float step, const float *points, int count, const unsigned short *polyFlags, std::string &out)
+{
+	out.reserve(out.size() + 5 + 5 + count * 6);
+	out.push_back((char)(NAV_PATH_CODEC_VERSION << 4 | (polyFlags ? NAV_PATH_CODEC_POLYFLAGS : 0)));
+	out.append((const char *)&step, sizeof(step));
+	NavPathPutVarint(out, (uint32_t)count);
+
+	const float inv = 1.0f / step;
+	int32_t prev[3] = {0, 0, 0};
+	for (int i = 0; i < count; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int32_t q = (int32_t)lroundf((points[i * 3 + k] - orig[k]) * inv);
+			NavPathPutVarint(out, NavPathZigzag(q - prev[k]));
+			prev[k] = q;
+		}
+
+		if (polyFlags)
+			NavPathPutVarint(out, polyFlags[i]);
+	}
+}
+
+/**
+ * Decodes a packed path back into xyz triples, the reference for client side
+ * decoders. Points land on the grid, so they are within step / 2 of the input.
+ * Returns false on a truncated or unknown buffer.
+ */
+static bool NavPathDecode(const void *data, size_t size, const float *orig, std::vector<float> &points, std::vector<unsigned short> *polyFlags)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + size;
+
+	if (size < 1 + sizeof(float) || (p[0] >> 4) != NAV_PATH_CODEC_VERSION)
+		return false;
+
+	const bool hasFlags = (p[0] & NAV_PATH_CODEC_POLYFLAGS) != 0;
+	float step;
+	memcpy(&step, p + 1, sizeof(step));
+	p += 1 + sizeof(step);
+
+	uint32_t count;
+	if (!NavPathGetVarint(p, end, count) || count > size)
+		return false;
+
+	points.clear();
+	points.reserve(count * 3);
+	if (polyFlags)
+		polyFlags->clear();
+
+	int32_t q[3] = {0, 0, 0};
+	for (uint32_t i = 0; i < count; i++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v;
+			if (!NavPathGetVarint(p, end, v))
+				return false;
+			q[k] += NavPathUnzigzag(v);
+			points.push_back(orig[k] + q[k] * step);
+		}
+
+		if (hasFlags)
+		{
+			uint32_t v;
+			if (!NavPathGetVarint(p, end, v))
+				return false;
+			if (polyFlags)
+				polyFlags->push_back((unsigned short)v);
+		}
+	}
+
+	return p == end;
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef _RECASTNAVIGATION_TRACE_H_
+#define _RECASTNAVIGATION_TRACE_H_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+
+// Query trace file layout:
+//   NavTraceFileHeader
+//   NavTraceRecord ...
+// A NAV_TRACE_SCENE record binds a scene id to a navmesh path and is followed by
+// 'result' bytes holding that path (no terminator). A NAV_TRACE_FILTER record is
+// followed by a NavTraceFilter defining filter profile 'filter' of the scene;
+// it is written before the first query using that profile and again whenever
+// the definition changes. Query records carry the call arguments in 'args' in
+// the same order as the Lua call, the profile id in 'filter' (0 is the default)
+// and, for FindStraightPath, the PathQuality in 'epsilon' / 'maxNodes'.
+
+static const uint32_t NAV_TRACE_MAGIC = 'N' << 24 | 'V' << 16 | 'T' << 8 | 'R';
+static const uint32_t NAV_TRACE_VERSION = 2;
+
+static const int NAV_TRACE_AREAS = 64; // DT_MAX_AREAS
+
+enum NavTraceOp
+{
+	NAV_TRACE_SCENE = 0,
+	NAV_TRACE_FIND_STRAIGHT_PATH = 1,			   // args: sx, sy, sz, ex, ey, ez
+	NAV_TRACE_FIND_RANDOM_POINT_AROUND_CIRCLE = 2, // args: cx, cy, cz, maxPoints, maxRadius
+	NAV_TRACE_RAYCAST = 3,						   // args: sx, sy, sz, ex, ey, ez
+	NAV_TRACE_OP_COUNT,
+	NAV_TRACE_FILTER = 255,
+};
+
+struct NavTraceFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct NavTraceRecord
+{
+	int64_t scene;
+	uint64_t timeUs; // since the trace was opened
+	uint8_t op;
+	uint8_t reserved;
+	uint16_t filter; // filter profile id
+	int32_t result;	 // handle return value (path size, point count, hit or error code)
+	uint32_t latencyNs;
+	int32_t maxNodes; // 0 when the query has no PathQuality
+	float epsilon;
+	float args[7];
+};
+
+// A filter profile as registered with AddFilter.
+struct NavTraceFilter
+{
+	int32_t id;
+	uint16_t includeFlags;
+	uint16_t excludeFlags;
+	float areaCosts[NAV_TRACE_AREAS];
+};
+
+static const char *NavTraceOpName(int op)
+{
+	switch (op)
+	{
+	case NAV_TRACE_FIND_STRAIGHT_PATH:
+		return "FindStraightPath";
+	case NAV_TRACE_FIND_RANDOM_POINT_AROUND_CIRCLE:
+		return "FindRandomPointAroundCircle";
+	case NAV_TRACE_RAYCAST:
+		return "Raycast";
+	default:
+		return "Unknown";
+	}
+}
+
+/**
+ * Process wide query recorder. Recording is off until Open() is called; while off
+ * the only cost on the query path is the IsOpen() check.
+ */
+class NavTraceWriter
+{
+public:
+	static const size_t FLUSH_SIZE = 64 * 1024;
+
+	static NavTraceWriter &Instance()
+	{
+		static NavTraceWriter writer;
+		return writer;
+	}
+
+	static uint64_t Now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+
+	bool IsOpen() const
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	bool Open(const char *path)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closeLocked();
+
+		fp = fopen(path, "wb");
+		if (!fp)
+		{
+			printf("NavTraceWriter::Open: open({%s}) is error!\n", path);
+			return false;
+		}
+
+		NavTraceFileHeader header;
+		header.magic = NAV_TRACE_MAGIC;
+		header.version = NAV_TRACE_VERSION;
+		fwrite(&header, sizeof(header), 1, fp);
+
+		startNs = Now();
+		enabled.store(true, std::memory_order_relaxed);
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closeLocked();
+	}
+
+	// 'filter' is NULL for the default profile.
+	void Record(int64_t scene, const std::string &resPath, int op, const float *args, int nargs, int result, uint64_t beginNs,
+				const NavTraceFilter *filter = NULL, float epsilon = 0.0f, int maxNodes = 0)
+	{
+		uint64_t endNs = Now();
+
+		NavTraceRecord rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.scene = scene;
+		rec.op = (uint8_t)op;
+		rec.filter = filter ? (uint16_t)filter->id : 0;
+		rec.result = result;
+		rec.latencyNs = (uint32_t)std::min<uint64_t>(endNs - beginNs, UINT32_MAX);
+		rec.maxNodes = maxNodes;
+		rec.epsilon = epsilon;
+		memcpy(rec.args, args, sizeof(float) * nargs);
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (!fp)
+			return;
+
+		rec.timeUs = (beginNs - startNs) / 1000;
+
+		auto it = scenes.find(scene);
+		if (it == scenes.end() || it->second != resPath)
+		{
+			scenes[scene] = resPath;
+
+			NavTraceRecord sceneRec;
+			memset(&sceneRec, 0, sizeof(sceneRec));
+			sceneRec.scene = scene;
+			sceneRec.timeUs = rec.timeUs;
+			sceneRec.op = NAV_TRACE_SCENE;
+			sceneRec.result = (int32_t)resPath.size();
+			append(&sceneRec, sizeof(sceneRec));
+			append(resPath.data(), resPath.size());
+		}
+
+		if (filter)
+		{
+			NavTraceFilter &known = filters[std::make_pair(scene, filter->id)];
+			if (memcmp(&known, filter, sizeof(known)) != 0)
+			{
+				known = *filter;
+
+				NavTraceRecord filterRec;
+				memset(&filterRec, 0, sizeof(filterRec));
+				filterRec.scene = scene;
+				filterRec.timeUs = rec.timeUs;
+				filterRec.op = NAV_TRACE_FILTER;
+				filterRec.filter = rec.filter;
+				filterRec.result = (int32_t)sizeof(NavTraceFilter);
+				append(&filterRec, sizeof(filterRec));
+				append(filter, sizeof(NavTraceFilter));
+			}
+		}
+
+		append(&rec, sizeof(rec));
+		if (buffer.size() >= FLUSH_SIZE)
+			flushLocked();
+	}
+
+private:
+	NavTraceWriter() : fp(NULL), startNs(0), enabled(false) {}
+
+	~NavTraceWriter()
+	{
+		Close();
+	}
+
+	void append(const void *data, size_t size)
+	{
+		const char *p = (const char *)data;
+		buffer.insert(buffer.end(), p, p + size);
+	}
+
+	void flushLocked()
+	{
+		if (fp && !buffer.empty())
+			fwrite(buffer.data(), 1, buffer.size(), fp);
+		buffer.clear();
+	}
+
+	void closeLocked()
+	{
+		enabled.store(false, std::memory_order_relaxed);
+		if (!fp)
+			return;
+
+		flushLocked();
+		fclose(fp);
+		fp = NULL;
+		scenes.clear();
+		filters.clear();
+	}
+
+	FILE *fp;
+	uint64_t startNs;
+	std::atomic<bool> enabled;
+	std::mutex lock;
+	std::vector<char> buffer;
+	std::unordered_map<int64_t, std::string> scenes;
+	std::map<std::pair<int64_t, int32_t>, NavTraceFilter> filters; // last definition written per (scene, id)
+};
+
+/**
+ * Reads a whole trace file, resolving scene records into 'scenes' and filter
+ * records into 'filters'. The 'filter' of a returned query record is rewritten
+ * to 1 + its definition's index in 'filters', 0 staying the default profile, so
+ * registering 'filters' in order on a fresh handle reproduces the ids.
+ */
+static bool NavTraceLoad(const char *path, std::vector<NavTraceRecord> &records, std::unordered_map<int64_t, std::string> &scenes,
+						 std::vector<NavTraceFilter> &filters)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+	{
+		printf("NavTraceLoad: open({%s}) is error!\n", path);
+		return false;
+	}
+
+	NavTraceFileHeader header;
+	if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != NAV_TRACE_MAGIC || header.version != NAV_TRACE_VERSION)
+	{
+		printf("NavTraceLoad: ({%s}) is not a trace file of version({%d})!\n", path, (int)NAV_TRACE_VERSION);
+		fclose(fp);
+		return false;
+	}
+
+	std::map<std::pair<int64_t, int32_t>, int> defined;
+	NavTraceRecord rec;
+	while (fread(&rec, sizeof(rec), 1, fp) == 1)
+	{
+		if (rec.op == NAV_TRACE_FILTER)
+		{
+			NavTraceFilter filter;
+			if (rec.result != (int32_t)sizeof(filter) || fread(&filter, sizeof(filter), 1, fp) != 1)
+				break;
+			filters.push_back(filter);
+			defined[std::make_pair(rec.scene, filter.id)] = (int)filters.size();
+			continue;
+		}
+
+		if (rec.op == NAV_TRACE_SCENE)
+		{
+			if (rec.result < 0)
+				break;
+
+			std::string resPath(rec.result, '\0');
+			if (fread(&resPath[0], 1, rec.result, fp) != (size_t)rec.result)
+				break;
+			scenes[rec.scene] = resPath;
+			continue;
+		}
+
+		if (rec.op < NAV_TRACE_OP_COUNT)
+		{
+			std::map<std::pair<int64_t, int32_t>, int>::const_iterator it = defined.find(std::make_pair(rec.scene, (int32_t)rec.filter));
+			rec.filter = it != defined.end() ? (uint16_t)it->second : 0;
+			records.push_back(rec);
+		}
+	}
+
+	fclose(fp);
+	return true;
+}
+
+#endif